@@ -15,31 +15,50 @@
  * - parse-out individual stages
  * - parse-out individual pipelines (if endchar is set)
  * - run all stages and wait for completion
+ *
+ * With --daemon the launcher instead stays up and waits on a local
+ * socket, and every other invocation of the launcher hands its whole
+ * command line to that daemon if one is running. See PIPEDAEMON below.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE                   /* struct ucred for SO_PEERCRED */
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
 #include <errno.h>
 
 #include <xfl.h>
 
 extern struct PIPECONN *xfl_pipeconn;
 extern struct PIPESTAGE *xfl_pipestage;
+extern int xfl_daemonfd;
 
-int main(int argc,char*argv[])
+/* ------------------------------------------------------------------ */
+static int pipemain(int argc,char*argv[])
   {
-    int rc, i, nullokay, snum, pnum, pend;
+    int rc, i, nullokay, check;
     char *arg0, *args, *p, *q, *r;
-    char *escape, *endchar, *stagesep, *pipename, *dotrace;
+    char *escape, *endchar, *stagesep, *pipename, *dotrace, *window, *threads;
+    char *affinity, *fuse;
     char *msgv[4], em[16];
-    struct PIPECONN *pi, *po, *px, *pp[3];
+    struct PIPECONN *pi, *px;
     int wpid, wstatus;
     struct PIPESTAGE *sx;
+    struct XFLPLAN *plan;
+    char planfile[8192];
 
     nullokay = 0;            /* null pipeline is *not* initially okay */
+    check = 0;                /* parse and find the stages, start none */
     /* but if we get --version or similar then empty pipeline is okay */
 
     /* inherit defaults established by parent or by the user */
@@ -49,6 +68,13 @@ int main(int argc,char*argv[])
     if (endchar == NULL)                                   endchar = "";
     stagesep = getenv("PIPEOPT_SEPARATOR");         /* default is bar */
     if (stagesep == NULL || *stagesep == 0x00)           stagesep = "|";
+    window = getenv("PIPEOPT_WINDOW");  /* default is zero, lock-step */
+    if (window == NULL)                                     window = "";
+    threads = getenv("PIPEOPT_THREADS");  /* default is all processes */
+    if (threads == NULL)                                   threads = "";
+    affinity = getenv("PIPEOPT_AFFINITY");     /* default is the kernel's */
+    if (affinity == NULL)                                 affinity = "";
+    fuse = "";      /* default is to fuse runs of supplied stages */
 
     pipename = dotrace = "";
 
@@ -85,9 +111,26 @@ int main(int argc,char*argv[])
           { if (argc < 3) { printf("error\n"); return 1; }
             pipename = argv[2]; argc--; argv++; } else
 
+        if (strcmp(argv[1],"--window") == 0)                /* WINDOW */
+          { if (argc < 3) { printf("error\n"); return 1; }
+            window = argv[2]; argc--; argv++; } else
+
         if (strcmp(argv[1],"--trace") == 0)                  /* TRACE */
             dotrace = "YES"; else
 
+        if (strcmp(argv[1],"--threads") == 0)              /* THREADS */
+            threads = "YES"; else
+
+        if (strcmp(argv[1],"--check") == 0)                  /* CHECK */
+            check = 1; else
+
+        if (strcmp(argv[1],"--no-fuse") == 0)              /* NOFUSE */
+            fuse = "NO"; else
+
+        if (strcmp(argv[1],"--affinity") == 0)            /* AFFINITY */
+          { if (argc < 3) { printf("error\n"); return 1; }
+            affinity = argv[2]; argc--; argv++; } else
+
           { /* 0014 E Option &1 not valid */
             msgv[1] = argv[1];
             xfl_error(14,2,msgv,"PIP"); /* 0014 E Option &1 not valid */
@@ -150,6 +193,24 @@ int main(int argc,char*argv[])
                 while (*p != ' ' && *p != '\t' && *p != 0x00) p++;
                 if (*p != 0x00) *p++ = 0x00; } else
 
+            if (strncasecmp(q,"WINDOW",3) == 0)             /* WINDOW */
+              { while ((*p == ' ' || *p == '\t') && *p != 0x00) p++;
+                if (*p != 0x00) window = p++;
+                while (*p != ' ' && *p != '\t' && *p != 0x00) p++;
+                if (*p != 0x00) *p++ = 0x00; } else
+
+            if (strncasecmp(q,"THREADS",3) == 0)           /* THREADS */
+                threads = "YES"; else
+
+            if (strncasecmp(q,"NOFUSE",6) == 0)             /* NOFUSE */
+                fuse = "NO"; else
+
+            if (strncasecmp(q,"AFFINITY",3) == 0)         /* AFFINITY */
+              { while ((*p == ' ' || *p == '\t') && *p != 0x00) p++;
+                if (*p != 0x00) affinity = p++;
+                while (*p != ' ' && *p != '\t' && *p != 0x00) p++;
+                if (*p != 0x00) *p++ = 0x00; } else
+
               { /* 0014 E Option &1 not valid */
                 msgv[1] = q;
                 xfl_error(14,2,msgv,"PIP");    /* Option &1 not valid */
@@ -175,134 +236,51 @@ int main(int argc,char*argv[])
     /* if tracing was requested then set this environment variable    */
     if (*dotrace != 0x00) setenv("PIPEOPT_TRACE",dotrace,1);
 
+    /* connectors pick up the window when xfl_pipepair() makes them   */
+    if (*window != 0x00) setenv("PIPEOPT_WINDOW",window,1);
+
+    /* and xfl_stagespawn() places each stage as it starts it         */
+    if (*affinity != 0x00) setenv("PIPEOPT_AFFINITY",affinity,1);
+
+    /* xfl_planstages() leaves each stage to itself (for debugging)   */
+    if (*fuse != 0x00) setenv("PIPEOPT_FUSE",fuse,1);
+
     /* now parse the duly derived pipeline                            */
 //  msgv[1] = args;
     msgv[1] = r;
     xfl_trace(3000,2,msgv,"PIP");
 
-    /* parse parse parse parse parse parse parse parse parse parse    */
-/* -- TOP OF PARSING ------------------------------------------------ */
-    /* parse parse parse parse parse parse parse parse parse parse    */
-
-    /* NOTE: this "parsing" section needs to be moved to the library  */
-
-    p = q = r;
-    pp[0] = pp[1] = pp[2] = px = NULL;    /* start with no connectors */
-
-    /* step through the pipeline specification string                 */
-    while (*p != 0x00)
-      {
-        while (*p != 0x00 && *p != *stagesep && *p != *endchar) p++;
-        /* we have a stage ... might be only one ... or a stream end  */
-
-        pi = pp[0];         /* input here is output of previous stage */
-                                 /* it's the read side of the PC pair */
-if (pi != NULL && px == NULL) px = pi;      /* not sure this is right */
-
-pend = 0;
-
-        if (*p == *stagesep)          /* we do have a follow-on stage */
-          {
-            *p++ = 0x00;                 /* terminate this sub-string */
-            xfl_pipepair(pp);        /* get a new connector pair pp[] */
-            po = pp[1];     /* our output is next's input (write end) */
-          } else {            /* we are the last stage in this stream */
-            if (*p && (*p == *endchar))
-              { /* the following three need to be done AFTER stage stacking */
-                pend = 1;
-                pnum = pnum + 1;            /* bump the stream number */
-//              snum = 1;                   /* reset the stage number */
-//              pp[0] = pp[1] = NULL;   /* start next w no connectors */
-              }
-            /* in any case ... */
-            if (*p) *p++ = 0x00;         /* terminate this sub-string */
-            po = NULL;       /* and we have no follow-on so no output */
-                 }
-
-        /* stack this stage */
-          {
-            int arqc, i;
-            char *arqv[3], *r, *l;
-            struct PIPESTAGE ps0, *ps; /* ps = &ps0; */
-
-            r = q;
-            /* skip past any leading white space */
-            while (*r == ' ' || *r == '\t')               r++;
-
-            /* peel-off any stage label */
-            l = r;
-            while (*r != ' ' && *r != '\t' && *r != ':' && *r != 0x00) r++;
-            if (*r == ':')
-              {
-                *r++ = 0x00;         /* delimit label and advance pointer */
-            /* skip past any leading white space */
-            while (*r == ' ' || *r == '\t')               r++;
-              } else {
-                r = l;
-                l = "";
-                     }
-
-            arqv[0] = r;         /* stage verb */
-            while (*r != ' ' && *r != '\t' && *r != 0x00) r++;
-            if (*r != 0x00) *r++ = 0x00;
-            arqv[1] = r;         /* stage args */
-            if (*r == 0x00) arqc = 1; else arqc = 2;
-//printf("verb '%s' args '%s'\n",arqv[0],arqv[1]);
-//printf("plenum: %s: %s\n",l,arqv[0]);
-
-        /* get a new struct for this stage */
-        xfl_getpipepart(&ps,l);
-//printf("pipe: label: %s\n",l);
-if (ps == NULL) printf("error\n");
-
-              {
-                char *v0, *v1;
-                v0 = arqv[0]; v1 = ps->arg0;
-                if (v0 == NULL) v0 = "";
-                if (v1 == NULL) v1 = "";
-if (*v0 && *v1) printf("plenum: ERROR: multiple commands on a stage\n");
-              }
-            if (arqv[0] != NULL && *arqv[0] != 0x00)
-              { ps->arg0 = arqv[0];
-                if (arqv[1] != NULL && *arqv[1] != 0x00)
-                    ps->args = arqv[1]; }
-
-//printf("plenum: PC counters %d %d\n",ps->ipcc,ps->opcc);
-            if (pi != NULL)
-              { ps->ipcv[ps->ipcc] = pi;
-                ps->ipcc = ps->ipcc + 1;
-                ps->ipcv[ps->ipcc] = NULL;       /* mark end of chain */
-                ps->xpcv[ps->xpcc] = pi;
-                ps->xpcc = ps->xpcc + 1;
-                ps->xpcv[ps->xpcc] = NULL; }     /* mark end of chain */
-            if (po != NULL)
-              { ps->opcv[ps->opcc] = po;
-                ps->opcc = ps->opcc + 1;
-                ps->opcv[ps->opcc] = NULL;       /* mark end of chain */
-                ps->xpcv[ps->xpcc] = po;
-                ps->xpcc = ps->xpcc + 1;
-                ps->xpcv[ps->xpcc] = NULL; }     /* mark end of chain */
-//printf("plenum: PC counters %d %d\n",ps->ipcc,ps->opcc);
-//printf("   pi = %08X;    po = %08X; %s\n",pi,po,ps->arg0);
-          }
-
-
-//      stagetot++;                    /* bump stagenum for reporting */
-        if (pend)       /* if end of stream then prep for next stream */
-          {
-                snum = 1;                   /* reset the stage number */
-                pp[0] = pp[1] = NULL;   /* start next w no connectors */
-          }
-        else    snum = snum + 1;      /* bump stagenum for next cycle */
-        q = p;    /* set q to point to next, if any */
-      }
-
-    /* parse parse parse parse parse parse parse parse parse parse    */
-/* -- END OF PARSING ------------------------------------------------ */
-    /* parse parse parse parse parse parse parse parse parse parse    */
-
-    /* be sure that stages won't get whacked by SIGPIPE on connectors */
-//  signal(SIGCHLD,SIG_IGN);
+    /* a plan cached by an earlier run of the same text saves parsing */
+    plan = NULL; planfile[0] = 0x00;
+    p = getenv("PIPEOPT_PLANCACHE");
+    if (p != NULL && *p != 0x00 && !check)
+      { snprintf(planfile,sizeof(planfile),"%s/%08x.plan",p,
+                                       xfl_planhash(r,stagesep,endchar));
+        if (xfl_planload(planfile,&plan) == 0)
+          { /* the hash is only where to look, the text has to match  */
+            if (plan->text < 0 || plan->stagesep < 0 || plan->endchar < 0
+             || strcmp((char*) plan + plan->text,r) != 0
+             || *((char*) plan + plan->stagesep) != *stagesep
+             || *((char*) plan + plan->endchar) != *endchar)
+              { free(plan); plan = NULL; }
+            else { msgv[1] = planfile;
+                   xfl_trace(3103,2,msgv,"PIP"); } } }
+
+    /* else parse it: stages, labels, streams, and connectors         */
+    if (plan == NULL)
+      { if (xfl_plan(r,stagesep,endchar,&plan) < 0) return 1;
+        if (*planfile != 0x00) xfl_plansave(plan,planfile); }
+
+    /* find every stage before starting any, so a pipeline with a     */
+    /* misspelled stage does not get partly underway                   */
+    if (xfl_plancheck(plan) < 0) return 1;
+    if (check) return 0;          /* --check: and that is as far as we go */
+
+    if (xfl_planstages(plan) < 0) return 1;
+    for (sx = xfl_pipestage; sx != NULL; sx = sx->next)
+      { char path[8192];
+        if (xfl_stagefind(sx->arg0,path,sizeof(path)) < 0) return 1;
+        sx->path = strdup(path); }
 
     /* launch all stacked/queued stages */
     i = 0; sx = xfl_pipestage;
@@ -323,7 +301,13 @@ if (*v0 && *v1) printf("plenum: ERROR: multiple commands on a stage\n");
 //      po = sx->opcv[0];   /* po */
 
         v = sx->xpcv;
-        xfl_stagespawn(c,arqv,v,sx);
+        rc = 1;
+        /* a stage built as a module can run in here as a thread      */
+        if (*threads != 0x00 && *threads != '0')
+            rc = xfl_stagethread(c,arqv,v,sx);
+        /* else a run of fused stages goes as one process             */
+        if (rc > 0) rc = xfl_stagefuse(sx);
+        if (rc > 0) xfl_stagespawn(c,arqv,v,sx);
 
         i = i + 1;
         sx = sx->next;
@@ -337,8 +321,10 @@ if (*v0 && *v1) printf("plenum: ERROR: multiple commands on a stage\n");
     px = xfl_pipeconn;
     i = 0 ; while (px != NULL)
       { i = i + 1;
+        if (!(px->flag & XFL_F_THREAD)) {  /* stage threads own these */
         close(px->fdf);
-        close(px->fdr);
+        if (px->fdr != px->fdf) close(px->fdr);
+        if (px->fdm >= 0) close(px->fdm); }
         pi = px;
         px = px->next;
         free(pi); }
@@ -358,9 +344,316 @@ if (*v0 && *v1) printf("plenum: ERROR: multiple commands on a stage\n");
 
     if (rc < 0 && errno != ECHILD) perror("waitpid()");
 
+    /* and for any stages which ran as threads of this process        */
+    xfl_stagejoin();
+
     return 0;
   }
 
+/* ------------------------------------------------------------------ */
+/* A job scheduler which runs many short pipelines pays each time for */
+/* starting the launcher and every stage from scratch. A launcher    */
+/* run with --daemon reads the message catalog and loads the stage    */
+/* modules once, then for each request forks a copy of itself, warm,  */
+/* which runs the pipeline with the caller's own stdin, stdout, and   */
+/* stderr and forks its stages without exec (PIPEOPT_SPAWN=WARM).     */
+/*                                                                    */
+/* A request is a PIPEREQ header, sent with the caller's descriptors  */
+/* 0, 1, and 2 attached, then the working directory, the arguments,   */
+/* and the environment, each string ending in a NUL. The reply is the */
+/* process ID of the copy, which leads a process group of its own so  */
+/* that the caller can pass on the signals it gets, then the          */
+/* launcher's return code, each as an int.                            */
+
+struct PIPEREQ {
+    int len;                       /* bytes of strings which follow */
+    int argc;
+    int envc;
+               };
+
+/* ------------------------------------------------------------ SOCKNAME
+ *  PIPEOPT_DAEMON names the socket, else it is per user.
+ *  Returns: NULL if the daemon is not to be used
+ */
+static char *pipesockname(char*buf,int buflen)
+  { char *p;
+    p = getenv("PIPEOPT_DAEMON");
+    if (p != NULL && (*p == '0' || *p == 'n' || *p == 'N')) return NULL;
+    if (p != NULL && *p != 0x00) snprintf(buf,buflen,"%s",p); else
+    if ((p = getenv("XDG_RUNTIME_DIR")) != NULL && *p != 0x00)
+        snprintf(buf,buflen,"%s/xfl.sock",p);
+    else snprintf(buf,buflen,"/tmp/xfl-%d.sock",(int) getuid());
+    return buf;
+  }
+
+/* ------------------------------------------------------------ PEERUSER
+ *  Is the other end of the socket run by the same user as we are?
+ *  Returns: non-zero if it is
+ */
+static int pipepeeruser(int fd)
+  {
+#if defined(SO_PEERCRED)
+    struct ucred uc; socklen_t ul = sizeof(uc);
+    if (getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&uc,&ul) != 0) return 0;
+    return (uc.uid == getuid());
+#elif defined(__FreeBSD__) || defined(__APPLE__)
+    uid_t uid; gid_t gid;
+    if (getpeereid(fd,&uid,&gid) != 0) return 0;
+    return (uid == getuid());
+#else
+    return 1;        /* no way to ask, so the socket mode has to do */
+#endif
+  }
+
+/* ------------------------------------------------------------- SIGNALS
+ *  While the daemon runs the pipeline, signals meant for it come here.
+ */
+static volatile sig_atomic_t pipesignal = 0;
+static void pipecatch(int sig) { pipesignal = sig; }
+
+/* ---------------------------------------------------------- PIPECLIENT
+ *  Hand this invocation to the daemon and wait for it to finish.
+ *  Returns: the pipeline's return code, or negative if there is no
+ *  daemon to take it, in which case the caller runs it right here
+ */
+static int pipeclient(int argc,char*argv[])
+  { struct sockaddr_un sa;
+    struct PIPEREQ rq;
+    struct msghdr mh;
+    struct iovec iov;
+    union { struct cmsghdr align; char buf[CMSG_SPACE(3*sizeof(int))]; } cm;
+    struct cmsghdr *ch;
+    struct sigaction sn, so[3];
+    sigset_t ss, om;
+    fd_set rs;
+    struct stat sb;
+    extern char **environ;
+    static int sigv[3] = { SIGINT, SIGTERM, SIGHUP };
+    char *buf, *p, cwd[8192];
+    int fd, i, n, rc, sig, reply[2];
+
+    if (pipesockname(sa.sun_path,sizeof(sa.sun_path)) == NULL) return -1;
+
+    /* only a socket of our own which nobody else can get at will do, */
+    /* else someone else could be handed our files and environment    */
+    if (lstat(sa.sun_path,&sb) != 0) return -1;
+    if (!S_ISSOCK(sb.st_mode) || sb.st_uid != getuid()
+                              || (sb.st_mode & 077) != 0) return -1;
+
+    sa.sun_family = AF_UNIX;
+    fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if (fd < 0) return -1;
+    if (connect(fd,(struct sockaddr*) &sa,sizeof(sa)) != 0)
+      { close(fd); return -1; }       /* no daemon: not an error */
+    if (!pipepeeruser(fd)) { close(fd); return -1; }
+
+    /* gather up the strings                                          */
+    if (getcwd(cwd,sizeof(cwd)) == NULL) strcpy(cwd,"/");
+    rq.argc = argc; rq.envc = 0;
+    rq.len = strlen(cwd) + 1;
+    for (i = 0; i < argc; i++) rq.len += strlen(argv[i]) + 1;
+    for (i = 0; environ[i] != NULL; i++)
+      { rq.len += strlen(environ[i]) + 1; rq.envc++; }
+    buf = malloc(rq.len);
+    if (buf == NULL) { close(fd); return -1; }
+    p = buf;
+    strcpy(p,cwd); p += strlen(p) + 1;
+    for (i = 0; i < argc; i++) { strcpy(p,argv[i]); p += strlen(p) + 1; }
+    for (i = 0; i < rq.envc; i++)
+      { strcpy(p,environ[i]); p += strlen(p) + 1; }
+
+    /* the header carries our stdin, stdout, and stderr along         */
+    memset(&mh,0x00,sizeof(mh));
+    iov.iov_base = &rq; iov.iov_len = sizeof(rq);
+    mh.msg_iov = &iov; mh.msg_iovlen = 1;
+    mh.msg_control = cm.buf; mh.msg_controllen = sizeof(cm.buf);
+    ch = CMSG_FIRSTHDR(&mh);
+    ch->cmsg_level = SOL_SOCKET;
+    ch->cmsg_type = SCM_RIGHTS;
+    ch->cmsg_len = CMSG_LEN(3*sizeof(int));
+    for (i = 0; i < 3; i++) ((int*) CMSG_DATA(ch))[i] = i;
+
+    rc = sendmsg(fd,&mh,0);
+    for (n = 0; rc >= 0 && n < rq.len; n += rc)
+        rc = write(fd,buf + n,rq.len - n);
+    free(buf);
+    if (rc < 0) { close(fd); return -1; }    /* daemon gone: run here */
+
+    /* from here on an interrupt is for the pipeline, not just us;    */
+    /* it is let in only while we wait, so it cannot come between the */
+    /* test for one and the wait, and sit there until the pipeline    */
+    /* ends on its own                                                */
+    sigemptyset(&ss);
+    for (i = 0; i < 3; i++) sigaddset(&ss,sigv[i]);
+    sigprocmask(SIG_BLOCK,&ss,&om);
+    memset(&sn,0x00,sizeof(sn));
+    sn.sa_handler = pipecatch;
+    sigemptyset(&sn.sa_mask);
+    for (i = 0; i < 3; i++) sigaction(sigv[i],&sn,&so[i]);
+
+    /* the daemon has it now; the copy running it says who it is,     */
+    /* then the return code; pass on any signal to its process group  */
+    reply[0] = 0; sig = 0;
+    for (n = 0; n < sizeof(reply); n += i)
+      { if (pipesignal != 0 && n >= sizeof(int) && reply[0] > 1)
+          { sig = pipesignal; pipesignal = 0; kill(-reply[0],sig); }
+        FD_ZERO(&rs); FD_SET(fd,&rs);
+        i = pselect(fd + 1,&rs,NULL,NULL,NULL,&om);
+        if (i < 0 && errno == EINTR) { i = 0; continue; }
+        if (i < 0) { perror("pipeclient(): pselect()"); rc = 1; break; }
+        i = read(fd,((char*) reply) + n,sizeof(reply) - n);
+        if (i < 0 && errno == EINTR) { i = 0; continue; }
+        if (i == 0 && sig != 0) break;     /* it went down with that */
+        if (i <= 0) { perror("pipeclient(): read()"); rc = 1; break; }
+        rc = reply[1]; }
+    close(fd);
+
+    /* and so do we, as if the pipeline had been run right here       */
+    for (i = 0; i < 3; i++) sigaction(sigv[i],&so[i],NULL);
+    sigprocmask(SIG_SETMASK,&om,NULL);
+    if (n < sizeof(reply) && sig != 0) { raise(sig); rc = 128 + sig; }
+    return rc;
+  }
+
+/* --------------------------------------------------------- PIPEREQUEST
+ *  In a fresh copy of the daemon: take on the caller's descriptors,
+ *  directory, and environment, and run the pipeline.
+ *  Returns: what the launcher would have, else negative
+ */
+static int piperequest(int fd)
+  { struct PIPEREQ rq;
+    struct msghdr mh;
+    struct iovec iov;
+    union { struct cmsghdr align; char buf[CMSG_SPACE(3*sizeof(int))]; } cm;
+    struct cmsghdr *ch;
+    char *buf, *p, **argv;
+    int i, n, rc, *fdv;
+
+    /* first of all, the caller passes its signals on to this process */
+    /* group, so even a request which fails gets a proper reply       */
+    setpgid(0,0);
+    n = getpid();
+    if (write(fd,&n,sizeof(n)) != sizeof(n)) return -1;
+
+    memset(&mh,0x00,sizeof(mh));
+    iov.iov_base = &rq; iov.iov_len = sizeof(rq);
+    mh.msg_iov = &iov; mh.msg_iovlen = 1;
+    mh.msg_control = cm.buf; mh.msg_controllen = sizeof(cm.buf);
+    rc = recvmsg(fd,&mh,MSG_WAITALL);
+    if (rc != sizeof(rq) || rq.len <= 0 || rq.argc < 1 || rq.envc < 0)
+        return -1;
+    ch = CMSG_FIRSTHDR(&mh);
+    if (ch == NULL || ch->cmsg_type != SCM_RIGHTS
+                   || ch->cmsg_len != CMSG_LEN(3*sizeof(int))) return -1;
+    fdv = (int*) CMSG_DATA(ch);
+    for (i = 0; i < 3; i++) { dup2(fdv[i],i); close(fdv[i]); }
+
+    buf = malloc(rq.len);
+    argv = malloc((rq.argc + 1) * sizeof(char*));
+    if (buf == NULL || argv == NULL) return -1;
+    for (n = 0; n < rq.len; n += rc)
+      { rc = read(fd,buf + n,rq.len - n);
+        if (rc <= 0) return -1; }
+    buf[rq.len-1] = 0x00;
+
+    /* directory, arguments, and environment, in that order           */
+    p = buf;
+    if (chdir(p) != 0) perror(p);
+    p += strlen(p) + 1;
+    for (i = 0; i < rq.argc && p < buf + rq.len; i++)
+      { argv[i] = p; p += strlen(p) + 1; }
+    argv[i] = NULL; rq.argc = i;
+    clearenv();
+    for (i = 0; i < rq.envc && p < buf + rq.len; i++)
+      { putenv(p); p += strlen(p) + 1; }
+    setenv("PIPEOPT_SPAWN","WARM",0);     /* unless the caller said */
+
+    return pipemain(rq.argc,argv);
+  }
+
+/* ---------------------------------------------------------- PIPEDAEMON
+ *  Listen on the socket and run a pipeline for each request.
+ *  Runs until killed.
+ */
+static int pipedaemon(int argc,char*argv[])
+  { struct sockaddr_un sa;
+    char *msgv[2];
+    mode_t um;
+    pid_t pid;
+    int fd, sd, rc;
+
+    /* the socket may be named on the command line                    */
+    if (argc > 2) setenv("PIPEOPT_DAEMON",argv[2],1);
+    if (pipesockname(sa.sun_path,sizeof(sa.sun_path)) == NULL)
+      { msgv[1] = "--daemon";
+        xfl_error(14,2,msgv,"PIP");    /* Option &1 not valid */
+        return 1; }
+    sa.sun_family = AF_UNIX;
+
+    sd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if (sd < 0) { perror("socket()"); return 1; }
+
+    /* a socket left behind by a daemon which is gone can be replaced */
+    if (connect(sd,(struct sockaddr*) &sa,sizeof(sa)) == 0)
+      { fprintf(stderr,"pipe: daemon already running on %s\n",sa.sun_path);
+        close(sd); return 1; }
+    unlink(sa.sun_path);
+
+    um = umask(077);                   /* just for this user, thanks */
+    rc = bind(sd,(struct sockaddr*) &sa,sizeof(sa));
+    umask(um);             /* but files the pipelines make as usual */
+    if (rc != 0 || listen(sd,64) != 0)
+      { perror(sa.sun_path); close(sd); return 1; }
+
+    /* everything the copies can have in memory before they are made  */
+    xfl_preload();
+
+    signal(SIGCHLD,SIG_IGN);       /* copies need not be waited for */
+    while (1)
+      {
+        fd = accept4(sd,NULL,NULL,SOCK_CLOEXEC);
+        if (fd < 0)
+          { if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept4()"); break; }
+
+        /* only the user who started the daemon may use it            */
+        if (!pipepeeruser(fd)) { close(fd); continue; }
+
+        pid = fork();
+        if (pid < 0) perror("fork()");
+        if (pid == 0)
+          { close(sd);
+            signal(SIGCHLD,SIG_DFL);   /* this copy waits for stages */
+            signal(SIGINT,SIG_DFL);    /* and stands in for the caller, */
+            signal(SIGTERM,SIG_DFL);   /* which passes these on even if */
+            signal(SIGHUP,SIG_DFL);    /* the daemon was started nohup  */
+            xfl_daemonfd = fd;      /* which stages forked warm close */
+            rc = piperequest(fd);
+            if (rc < 0) rc = 1;
+            fflush(NULL);
+            write(fd,&rc,sizeof(rc));
+            exit(0); }
+        close(fd);
+      }
+
+    close(sd); unlink(sa.sun_path);
+    return 1;
+  }
+
+/* ------------------------------------------------------------------ */
+int main(int argc,char*argv[])
+  {
+    int rc;
+
+    /* pipe --daemon [socket] runs the daemon, else look for one      */
+    if (argc > 1 && strcmp(argv[1],"--daemon") == 0)
+        return pipedaemon(argc,argv);
+    rc = pipeclient(argc,argv);
+    if (rc >= 0) return rc;
+
+    return pipemain(argc,argv);
+  }
+
 /*
 
 label logic
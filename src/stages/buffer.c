@@ -11,35 +11,34 @@
 
 #include <xfl.h>
 
-typedef struct BUFFSTRUCT {
-    char *ad;                  /* address of the data for this record */
-    int len;                                 /* length of this record */
-    void *prev;                /* pointer to previous struct in chain */
-    void *next;                /* pointer to next struct in the chain */
-                          } BUFFSTRUCT;
+/* records are packed into chunks of this size, unless bigger        */
+#define  XFL_BUFFER_CHUNK  1048576
+
+/* every chunk, and every big record, starts with a pointer to the    */
+/* one taken before it, so that all of them can be given back at end  */
+#define  XFL_BUFFER_LINK   sizeof(char*)
 
 static char _eyeball0[] = "XFL pipeline stage 'buffer'";
 
+/* ------------------------------------------------------------------ */
+/* free the chain of chunks and big records, newest first              */
+static void buffer_free(char*bl)
+  { char *bp;
+    while (bl != NULL) { bp = *(char**) bl; free(bl); bl = bp; }
+  }
+
 /* ------------------------------------------------------------------ */
 int main(int arg,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'buffer' main()";
-    int rc, i, o, reclen;
-    char *bp, *bi;
+    int rc, i, o, n, used, bad;
+    char *bc, *bi, *bl;
     struct PIPECONN *pc, *pi, *po, *pn;
-    struct BUFFSTRUCT *bs, *bq, bs0;
+    struct iovec *rv, *rq, r0;
 
     /* initialize this stage                                          */
     rc = xfl_stagestart(&pc);
     if (rc < 0) return 1;
 
-    /* start with an array to handle 1000 records */
-    bs = malloc(sizeof(bs0)*1000);
-    if (bs == NULL) { perror("malloc()"); return 1; }
-
-    /* allocate a chunk of memory to hold the records */
-    bi = bp = malloc(1048576);
-    if (bp == NULL) { perror("malloc()"); return 1; }
-
     /* snag the first input stream and the first output stream        */
     pi = po = NULL;
     for (pn = pc; pn != NULL; pn = pn->next)
@@ -54,22 +53,55 @@ int main(int arg,char*argv[])
       { xfl_error(61,0,NULL,"BUF");        /* provide specific report */
         return 1; }
 
-    /* start with an index offset of zero */
-    i = 0;
+    /* start with an array to handle 1000 records, grown as needed */
+    n = 1000;
+    rv = malloc(sizeof(r0)*n);
+    if (rv == NULL) { perror("malloc()"); return 1; }
 
-    reclen = 4096;   /* arbitrary */
+    /* allocate a chunk of memory to hold the records */
+    bc = bl = malloc(XFL_BUFFER_CHUNK);
+    if (bc == NULL) { perror("malloc()"); free(rv); return 1; }
+    *(char**) bc = NULL; used = XFL_BUFFER_LINK;
+
+    /* start with an index offset of zero */
+    i = 0; bad = 0;
 
     /* "Do Forever" until we break out otherwise */
     while (1) {
 
-        /* perform a PEEKTO and see if there is a record ready        */
-        rc = xfl_peekto(pi,bi,reclen);                /* sip on input */
+        /* double the array of records when it fills up               */
+        if (i >= n)
+          { rq = realloc(rv,sizeof(r0)*n*2);
+            if (rq == NULL) { perror("realloc()"); bad = 1; break; }
+            rv = rq; n = n * 2; }
+
+        /* take as many records as are ready and fit in this chunk    */
+        o = n - i; if (o > XFL_BATCH_MAX) o = XFL_BATCH_MAX;
+        rc = xfl_readto_batch(pi,&rv[i],o,bc + used,XFL_BUFFER_CHUNK - used);
         if (rc < 0) break;
+        if (rc > 0)
+          { for (o = 0; o < rc; o++) used = used + rv[i+o].iov_len;
+            i = i + rc;     /* bump up the index past these records */
+            continue; }
 
-        bq = &bs[i];       /* use BQ as a pointer to struct .. easier */
-        bq->ad = bi;               /* member AD points to this record */
-        bq->len = rc;     /* member LEN had the length of this record */
-        bi = &bi[rc];        /* set index pointer past record content */
+        /* the next record did not fit, so see how big it is          */
+        rc = xfl_peekto(pi,NULL,0);
+        if (rc < 0) break;
+        if (rc <= XFL_BUFFER_CHUNK / 4)
+          { /* start a fresh chunk and go around again                */
+            bc = malloc(XFL_BUFFER_CHUNK);
+            if (bc == NULL) { perror("malloc()"); bad = 1; break; }
+            *(char**) bc = bl; bl = bc; used = XFL_BUFFER_LINK;
+            continue; }
+
+        /* a big record gets storage all to itself                    */
+        bi = malloc(XFL_BUFFER_LINK + rc);
+        if (bi == NULL) { perror("malloc()"); bad = 1; break; }
+        *(char**) bi = bl; bl = bi;
+        rc = xfl_peekto(pi,bi + XFL_BUFFER_LINK,rc);  /* sip on input */
+        if (rc < 0) break;
+        rv[i].iov_base = bi + XFL_BUFFER_LINK;   /* points to the record */
+        rv[i].iov_len = rc;        /* and this is the length of it */
         i++;                  /* bump up the index to the next record */
 
         /* now consume the record from the input stream               */
@@ -78,20 +110,22 @@ int main(int arg,char*argv[])
       }
 
 #ifdef XFL_STAGE_REVERSE
-    for (o = i - 1; o > -1; o--)
-#else
-    for (o = 0; o < i; o++)
+    /* turn the array around so that the last record goes out first   */
+    for (o = 0; o < i / 2; o++)
+      { r0 = rv[o]; rv[o] = rv[i-1-o]; rv[i-1-o] = r0; }
 #endif
-      {
-        bq = &bs[o];       /* use BQ as a pointer to struct .. easier */
-        /* write this record from memory to the output stream         */
-        rc = xfl_output(po,bq->ad,bq->len);
-        if (rc < 0) break;
-      }
+
+    /* write the records from memory to the output stream, together   */
+    if (!bad) rc = xfl_output_batch(po,rv,i);
+
+    /* the records are gone, and running as a thread of the launcher  */
+    /* the storage would otherwise outlive the stage                  */
+    buffer_free(bl);
+    free(rv);
 
     /* terminate this stage cleanly                                   */
     rc = xfl_stagequit(pc);
-    if (rc < 0) return 1;
+    if (rc < 0 || bad) return 1;
 
     /* pass a "success" return code to our caller */
     return 0;
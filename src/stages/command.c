@@ -7,6 +7,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 
@@ -21,7 +22,9 @@ static char _eyeball0[] = "XFL pipeline stage 'command'";
 int do1command(PIPECONN*pp,char*cmd)
   { static char _eyecatcher[] = "XFL pipeline stage 'command' do1command()";
     int buflen, rc;
-    char buffer[4096], *s;
+    char *buffer;
+    size_t bufsize;
+    ssize_t linelen;
     FILE *cf;
 
 #ifdef DEVELOPMENT
@@ -37,14 +40,15 @@ perror("do1command(): popen():");
 printf("command: shell pipe opened\n");
 
     /* loop, converting lines of output into records and send along   */
+    buffer = NULL; bufsize = 0;  /* getline() grows it to fit the line */
     while (1)
       {
 
         /* read one line from cf */
-        s = fgets(buffer,buflen,cf);
-        if (s == NULL)
+        linelen = getline(&buffer,&bufsize,cf);
+        if (linelen < 0)
           {
-perror("do1command(): fgets():");
+perror("do1command(): getline():");
             // FIXME: check errno
             // end-of-file is okay
             break; }
@@ -52,8 +56,8 @@ perror("do1command(): fgets():");
 printf("command: got a line %s\n",buffer);
 #endif
 
-buflen = strlen(buffer);
-if (buffer[buflen-1] == '\n') buflen = buflen - 1;
+buflen = linelen;
+if (buflen > 0 && buffer[buflen-1] == '\n') buflen = buflen - 1;
 
         /* write the record to our primary output stream              */
         rc = xfl_output(pp,buffer,buflen);      /* send it downstream */
@@ -64,6 +68,8 @@ printf("%s\n",buffer);
 #endif
       }
 
+    free(buffer);
+
     /* close the FILE handle and try to process the condition code    */
     rc = pclose(cf);
     if (rc < 0) return rc;              /* Error reported by pclose() */
@@ -75,8 +81,8 @@ printf("%s\n",buffer);
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'command' main()";
-    int buflen, rc;
-    char *args, buffer[4096];
+    int buflen, bufsize, rc;
+    char *args, *buffer;
     struct PIPECONN *pc, *pi, *po, *pn;
 
 #ifdef DEVELOPMENT
@@ -120,12 +126,13 @@ if (pi != NULL)
 printf("command: YES input is connected\n");
 #endif
 
+    buffer = NULL; bufsize = 0;     /* grows to fit records as needed */
     while (1)
       {
         /* perform a PEEKTO and see if there is a record ready        */
-        buflen = sizeof(buffer) - 1;
-        rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ buflen = rc;
+        buffer[buflen] = 0x00;     /* the record is a command string */
 #ifdef DEVELOPMENT
 printf("command: got a record\n");
 #endif
@@ -145,6 +152,8 @@ printf("command: consumed the record\n");
 #endif
       }
 
+    free(buffer);
+
     /* terminate this stage cleanly - free the PIPECONN structs       */
     rc = xfl_stagequit(pc);
     if (rc < 0) return 1;
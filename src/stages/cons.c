@@ -1,9 +0,0 @@
-/* abbreviation for 'console' */
-static char _eyeball1[] = "XFL pipeline stage 'cons'";
-#include "console.c"
-
-/* NOTE: abbreviation really should be better than just
-      a bunch of duplicated logic in files with shortened names
-      and should be handled by the xfl_stagespawn() routin            */
-
-
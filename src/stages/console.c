@@ -13,8 +13,9 @@
  */
 
 #include <stdio.h>
-#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
 #include <xfl.h>
 
@@ -23,8 +24,10 @@ static char _eyeball0[] = "XFL pipeline stage 'console'";
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'console' main()";
-    int i, buflen, rc;
-    char buffer[4096], *p;
+    int i, buflen, bufsize, rc;
+    char *buffer, piece[4096];
+    size_t linesize;
+    ssize_t linelen;
     struct PIPECONN *pc, *pi, *po, *pn;
 
     /* initialize this stage                                          */
@@ -50,12 +53,14 @@ int main(int argc,char*argv[])
         xfl_error(1493,3,msgv,"CON");      /* provide specific report */
         return 1; }
 
+    /* records of any length: the buffer grows to fit as needed      */
+    buffer = NULL; bufsize = 0; linesize = 0;
+
     if (pi == NULL) while (1)
       { /* with no primary input we ARE a first stage                 */
-        buflen = sizeof(buffer);
-        p = fgets(buffer,buflen,stdin);
-        if (p == NULL) break;
-        buflen = strlen(p);
+        linelen = getline(&buffer,&linesize,stdin);
+        if (linelen < 0) break;
+        buflen = linelen;
         if (buflen > 0)
           { i = buflen - 1;
             if (buffer[i] == '\n') { buffer[i] = 0x00; buflen = i; } }
@@ -64,22 +69,30 @@ int main(int argc,char*argv[])
         if (rc < 0) break;
       }
 
+    else if (po == NULL) while (1)
+      { /* nothing downstream, so copy the record to stdout in pieces */
+        while ((rc = xfl_peekto_part(pi,piece,sizeof(piece))) > 0)
+            fwrite(piece,1,rc,stdout);        /* write it to stdout */
+        if (rc < 0) break;
+        putchar('\n');
+
+        xfl_readto(pi,NULL,0);                  /* consume the record */
+      }
+
     else while (1)
       {
-        buflen = sizeof(buffer) - 1;
-
-        rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ buflen = rc;
-        buffer[buflen] = 0x00;     /* terminate the string for stdout */
 
-        printf("%s\n",buffer);                  /* write it to stdout */
+        fwrite(buffer,1,buflen,stdout);         /* write it to stdout */
+        putchar('\n');
 
-        if (po != NULL) {
         rc = xfl_output(po,buffer,buflen);      /* send it downstream */
-        if (rc < 0) break; }
+        if (rc < 0) break;
 
         xfl_readto(pi,NULL,0);    /* consume the record after sending */
       }
+    free(buffer);
 
     /* dropping out of either loop, if error then exit immediately    */
     if (rc < 0) return 1;
@@ -32,8 +32,9 @@ static char _eyeball0[] = "XFL pipeline stage 'count'";
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'count' main()";
     int rc, chars, words, lines, minln, maxln, om[8], reclen, i, o;
-    char *args, *p, *q, *msgv[2], em[16], buffer[4096];
-    struct PIPECONN *pc, *pn, *pi, *po, *po2;
+    char *args, *p, *q, *msgv[2], em[16], *buffer, totals[256];
+    int bufsize;
+    struct PIPECONN *pc, *pi, *po, *po2;
 
     /* initialize this stage                                          */
     rc = xfl_stagestart(&pc);
@@ -49,14 +50,10 @@ int main(int argc,char*argv[])
     if (args == NULL) return 1;
 
     /* snag the first input stream and the first output stream        */
-    pi = po = po2 = NULL;
-    for (pn = pc; pn != NULL; pn = pn->next)
-      { if (pn->flag & XFL_F_OUTPUT) { if (po == NULL) po = pn; }
-        if (pn->flag & XFL_F_INPUT)  { if (pi == NULL) pi = pn; } }
+    pi = xfl_input_stream(0);
+    po = xfl_output_stream(0);
     /* snag the second output stream, if any                          */
-    while (pn != NULL && po2 == NULL)
-      { if (pn->flag & XFL_F_OUTPUT) po2 = pn;
-        pn = pn->next; }
+    po2 = xfl_output_stream(1);
 
     /* find the first blank-delimited token in the argument string    */
     p = args; while ((*p == ' ' || *p == '\t') && *p != 0x00) p++;
@@ -91,12 +88,12 @@ printf("count: %s\n",p);
 
     /* proper pipeline ...                                            *
      *             ... copy all input records, if any, to the output  */
+    buffer = NULL; bufsize = 0;     /* grows to fit records as needed */
 //  if (po != NULL)
     while (1)
       {
         /* perform a PEEKTO and see if there is a record ready        */
-        reclen = sizeof(buffer) - 1;
-        rc = xfl_peekto(pi,buffer,reclen);            /* sip on input */
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ reclen = rc;
 
         chars = chars + reclen;
@@ -114,8 +111,10 @@ printf("count: %s\n",p);
         if (rc < 0) break;
       }
 
+    free(buffer);
+
     /* write the record with all the counted totals                   */
-    p = buffer;
+    p = buffer = totals;
     for (o = 0; o < i;o++)
       {
         switch (om[i])
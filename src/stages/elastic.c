@@ -1,3 +0,0 @@
-/* substitute 'elastic' with 'buffer' for the time being */
-static char _eyeball1[] = "XFL pipeline stage 'elastic'";
-#include "buffer.c"
@@ -12,6 +12,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 /* development: the following is for sleep() */
 #include <unistd.h>
@@ -23,9 +24,9 @@ static char _eyeball0[] = "XFL pipeline stage 'fanin'";
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'fanin' main()";
-    int buflen, rc;
-    char buffer[4096];
-    struct PIPECONN *pc, *pi, *po, *pn;
+    int buflen, bufsize, rc, k;
+    char *buffer;
+    struct PIPECONN *pc, *pi, *po;
 
 #ifdef DEVELOPMENT
 printf("fanin: (starting)\n");
@@ -35,10 +36,8 @@ printf("fanin: (starting)\n");
     rc = xfl_stagestart(&pc);
     if (rc < 0) return 1;
 
-    /* snag the primary output stream (scanning all connectors)       */
-    po = NULL;
-    for (pn = pc; po == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_OUTPUT) po = pn;
+    /* snag the primary output stream                                 */
+    po = xfl_output_stream(0);
 
     /* if no output then stop now */
     if (po == NULL)
@@ -51,16 +50,19 @@ printf("fanin: (starting)\n");
 printf("fanin: YES output is connected\n");
 #endif
 
-    /* snag the first input stream from the chain-o-connectors        */
+    /* snag the first input stream which is connected                 */
     pi = NULL;
-    for (pn = pc; pi == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_INPUT) pi = pn;
+    for (k = 0; pi == NULL && k < xfl_streams(XFL_F_INPUT); k++)
+      pi = xfl_input_stream(k);
 
 #ifdef DEVELOPMENT
 if (pi != NULL)
 printf("fanin: YES input is connected\n");
 #endif
 
+    /* records of any length: the buffer grows to fit as needed      */
+    buffer = NULL; bufsize = 0;
+
     while (pi != NULL)
       {
 //printf("fanin: top of loop\n");
@@ -68,8 +70,7 @@ printf("fanin: YES input is connected\n");
         while (1)
           {
             /* perform a PEEKTO and see if there is a record ready        */
-            buflen = sizeof(buffer) - 1;
-            rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
+            rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize); /* sip */
             if (rc < 0) break; /* else */ buflen = rc;
 #ifdef DEVELOPMENT
 printf("fanin: got a record\n");
@@ -91,13 +92,14 @@ printf("fanin: consumed the record\n");
           }
 
 //printf("fanin: looking for next input\n");
-        /* snag the next input, if any */
-        pn = pi->next;
-        for (pi = NULL; pi == NULL && pn != NULL; pn = pn->next)
-          if (pn->flag & XFL_F_INPUT) pi = pn;
+        /* snag the next input, if any, in stream number order */
+        for (pi = NULL; pi == NULL && k < xfl_streams(XFL_F_INPUT); k++)
+          pi = xfl_input_stream(k);
       }
 
 //printf("fanin: shutdown??\n");
+    free(buffer);
+
     /* terminate this stage cleanly                                   */
     rc = xfl_stagequit(pc);
     if (rc < 0) return 1;
@@ -0,0 +1,98 @@
+/*
+ *        Name: faninany.c (C program source)
+ *              POSIX Pipelines FANINANY stage
+ *        Date: 2026-10-17
+ *              passes records from whichever input has one ready
+ *
+ * (from CMS HELP PIPE FANINANY)
+ * "faninany" passes records from all connected input streams to the
+ * primary output stream, taking them as they arrive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xfl.h>
+
+static char _eyeball0[] = "XFL pipeline stage 'faninany'";
+
+/* ------------------------------------------------------------------ */
+int main(int argc,char*argv[])
+  { static char _eyecatcher[] = "XFL pipeline stage 'faninany' main()";
+    int buflen, bufsize, rc, ni, nlive, k;
+    char *buffer;
+    struct PIPECONN *pc, *po, **pi;
+
+    /* initialize this stage                                          */
+    rc = xfl_stagestart(&pc);
+    if (rc < 0) return 1;
+
+    /* snag the primary output stream                                 */
+    po = xfl_output_stream(0);
+
+    /* if no output then stop now */
+    if (po == NULL)
+      {
+        xfl_stagequit(pc);
+        return 0;
+      }
+
+    /* gather up all of the input streams, however many there are     */
+    ni = xfl_streams(XFL_F_INPUT);
+    pi = malloc((ni + 1) * sizeof(PIPECONN*));
+    if (pi == NULL)
+      { perror("faninany: malloc()");
+        xfl_stagequit(pc);
+        return 1; }
+    nlive = 0;
+    for (k = 0; k < ni; k++)
+      if ((pi[k] = xfl_input_stream(k)) != NULL) nlive++;
+
+    /* records of any length: the buffer grows to fit as needed      */
+    buffer = NULL; bufsize = 0;
+
+    while (nlive > 0)
+      {
+        /* wait for any input to have a record (or to reach its end)  */
+        rc = xfl_wait_any(pi,ni,-1);
+        if (rc < 0) break;
+
+        /* take one record from each input which has one, in turn    */
+        for (k = 0; k < ni; k++)
+          { if (pi[k] == NULL || (pi[k]->flag & XFL_F_READY) == 0) continue;
+
+            rc = xfl_peekto_alloc(pi[k],(void**) &buffer,&bufsize);
+            if (rc < 0) { pi[k] = NULL; nlive--; continue; }
+            buflen = rc;
+
+            /* write the record to our primary output stream          */
+            rc = xfl_output(po,buffer,buflen);  /* send it downstream */
+            if (rc < 0) { nlive = 0; break; }
+
+            /* now consume the record from the input stream           */
+            rc = xfl_readto(pi[k],NULL,0);  /* consume after sending */
+            if (rc < 0) { pi[k] = NULL; nlive--; } }
+      }
+
+    free(buffer);
+    free(pi);
+
+    /* terminate this stage cleanly                                   */
+    rc = xfl_stagequit(pc);
+    if (rc < 0) return 1;
+
+    /* pass a "success" return code to our caller */
+    return 0;
+  }
+
+/*
+//MD
+//MD* faninany
+//MD
+//MDUse the `faninany` stage to collect multiple input streams
+//MDinto a single output, taking records from whichever input
+//MDhas one ready rather than draining the inputs in order.
+//MD
+ */
+
+
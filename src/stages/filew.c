@@ -8,7 +8,9 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <errno.h>
 
 #include <xfl.h>
@@ -18,9 +20,10 @@ static char _eyeball0[] = "XFL pipeline stage 'filew'";
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'filew' main()";
-    int rc, fd, buflen;
-    char *args, *fn, buffer[4096], *p, *q, *msgv[16];
+    int rc, fd, buflen, bufsize;
+    char *args, *fn, *buffer, piece[4096], *p, *q, *msgv[16];
     struct PIPECONN *pc, *pi, *po, *pn;
+    struct iovec iov[2];
 
     /* initialize this stage                                          */
     rc = xfl_stagestart(&pc);
@@ -67,23 +70,41 @@ int main(int argc,char*argv[])
     /* 0127 E This stage cannot be first in a pipeline                */
     if (pi == NULL) { xfl_error(127,0,NULL,"FIO"); return 1; }
 
-    while (1)
+    /* with nothing downstream, copy each record to the file in pieces */
+    if (po == NULL) while (1)
       {
-        buflen = sizeof(buffer);        /* start with max record size */
-        rc = xfl_peekto(pi,buffer,buflen-1);      /* sip on the input */
+        while ((rc = xfl_peekto_part(pi,piece,sizeof(piece))) > 0)
+          { rc = write(fd,piece,rc);
+            if (rc < 0) break; }
+        if (rc < 0) break;
+        rc = write(fd,"\n",1);    /* and mark it with a newline character */
+        if (rc < 0) break;
+
+        /* now consume the record from the input stream               */
+        rc = xfl_readto(pi,NULL,0);             /* consume the record */
+        if (rc < 0) break;
+      }
+
+    /* records of any length: the buffer grows to fit as needed      */
+    buffer = NULL; bufsize = 0;
+
+    if (po != NULL) while (1)
+      {
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ buflen = rc;
-        buffer[buflen++] = '\n';  /* mark it with a newline character */
-        buffer[buflen] = 0x00;                /* terminate the string */
 //printf("filew: got a record %d\n",buflen);
 
+        /* the record and its newline go out together, without a copy */
+        iov[0].iov_base = buffer; iov[0].iov_len = buflen;
+        iov[1].iov_base = "\n";   iov[1].iov_len = 1;
+
         /* write this record to the file */
-        rc = write(fd,buffer,buflen);
+        rc = writev(fd,iov,2);
 //      if (rc < buflen) break;
         if (rc < 0) break;
-//      write(fd,"\n",1);     /* and mark it with a newline character */
 
         /* write the record to our primary output stream              */
-        if (po != NULL) rc = xfl_output(po,buffer,buflen);
+        rc = xfl_outputv(po,iov,2);
 //      if (rc < 0) break;
 
         /* now consume the record from the input stream               */
@@ -91,6 +112,7 @@ int main(int argc,char*argv[])
         if (rc < 0) break;
       }
 
+    free(buffer);
     close(fd);
 
     /* terminate this stage cleanly                                   */
@@ -8,14 +8,18 @@
 
 #include <xfl.h>
 
+/* records are drained this many at a time, if they are small enough  */
+#define  XFL_HOLE_BATCH  256
+
 static char _eyeball0[] = "XFL pipeline stage 'hole'";
 
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'hole' main()";
     int rc;
-    char *msgv[4], em[16];
+    char *msgv[4], em[16], buffer[65536];
     struct PIPECONN *pc, *pi, *po, *pn;
+    struct iovec iov[XFL_HOLE_BATCH];
 
     /* initialize this stage                                          */
     rc = xfl_stagestart(&pc);
@@ -39,7 +43,11 @@ int main(int argc,char*argv[])
 
     /* just consume all input records and do nothing with them        */
     while (1)
-      { /* consume one record from the input stream                   */
+      { /* consume as many records from the input stream as are ready */
+        rc = xfl_readto_batch(pi,iov,XFL_HOLE_BATCH,buffer,sizeof(buffer));
+        if (rc < 0) break;
+        if (rc > 0) continue;
+        /* else the next one was too big for the buffer               */
         rc = xfl_readto(pi,NULL,0);
         if (rc < 0) break; }
 
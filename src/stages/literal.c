@@ -21,8 +21,8 @@ static char _eyeball0[] = "XFL pipeline stage 'literal'";
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'literal' main()";
-    int i, buflen, rc, argl;
-    char buffer[4096], *p, *q, *args;
+    int i, buflen, bufsize, rc, argl;
+    char *buffer, *p, *q, *args;
     struct PIPECONN *pc, *pi, *po, *pn;
 
 /*
@@ -58,11 +58,11 @@ int main(int argc,char*argv[])
 
     /* proper pipeline: once we have written the literal to the       *
      * output, we then copy all input records, if any, to the output  */
+    buffer = NULL; bufsize = 0;     /* grows to fit records as needed */
     if (pi != NULL) while (1)
       {
         /* perform a PEEKTO and see if there is a record ready        */
-        buflen = sizeof(buffer) - 1;
-        rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ buflen = rc;
 
         /* write the record to our primary output stream              */
@@ -72,6 +72,7 @@ int main(int argc,char*argv[])
         /* now consume the record from the input stream               */
         xfl_readto(pi,NULL,0);                  /* consume the record */
       }
+    free(buffer);
 
     /* terminate this stage cleanly                                   */
     rc = xfl_stagequit(pc);
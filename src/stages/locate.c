@@ -15,12 +15,26 @@
 
 static char _eyeball0[] = "XFL pipeline stage 'locate'";
 
+/* ------------------------------------------------------------------ */
+/* search a record which is not a string and may not be written to    */
+static int found(const char*hay,int haylen,const char*needle,int nlen)
+  { const char *p, *e;
+    if (nlen == 0) return 1;
+    e = hay + haylen - nlen;
+    for (p = hay; p <= e; p++)
+      { p = memchr(p,*needle,e - p + 1);
+        if (p == NULL) return 0;
+        if (memcmp(p,needle,nlen) == 0) return 1; }
+    return 0;
+  }
+
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'locate' main()";
-    int rc, buflen;
-    char *args, *p, *q, *needle, buffer[4096];
-    struct PIPECONN *pc, *pi, *pop, *pos, *pn;
+    int rc, buflen, nlen;
+    char *args, *p, *q, *needle;
+    const void *buffer;
+    struct PIPECONN *pc, *pi, *pop, *pos;
 
     /* initialize this stage                                          */
     rc = xfl_stagestart(&pc);
@@ -41,40 +55,36 @@ int main(int argc,char*argv[])
 //printf("locate: needle '%s'\n",needle);
 
 
-    /* snag the first input stream and the first two output streams   */
-    pi = pop = pos = NULL;
-    for (pn = pc; pn != NULL && pi == NULL; pn = pn->next)
-      { if (pn->flag & XFL_F_INPUT)  pi = pn; }
-    for (pn = pc; pn != NULL && pop == NULL; pn = pn->next)
-      { if (pn->flag & XFL_F_OUTPUT) pop = pn; }
-    for (       ; pn != NULL && pos == NULL; pn = pn->next)
-      { if (pn->flag & XFL_F_OUTPUT) pos = pn; }
+    /* snag the primary input stream and the first two output streams */
+    pi  = xfl_input_stream(0);
+    pop = xfl_output_stream(0);
+    pos = xfl_output_stream(1);       /* secondary output, if connected */
 
 //printf("locate: %08X %08X %08X\n",pi,pop,pos);
 //system("printenv | grep 'PIPE'");
 
+    nlen = strlen(needle);
+
     while (1)
       {
         /* perform a PEEKTO and see if there is a record ready        */
-        buflen = sizeof(buffer) - 1;
-        rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
-        if (rc < 0) break; /* else */ buflen = rc;
-        buffer[buflen] = 0x00;
+        /* the record is borrowed, not copied: look but do not touch  */
+        rc = xfl_peekref(pi,&buffer,&buflen);                    /* sip */
+        if (rc < 0) break;
 
 #ifdef XFL_STAGE_NLOCATE
-//printf("nlocate: haystack '%s'\n",buffer);
 //printf("nlocate: needle '%s'\n",needle);
         /* is string NOT present? Y: write to primary, N: secondary   */
-        if (strstr(buffer,needle) == NULL)
+        if (!found(buffer,buflen,needle,nlen))
 #else
-//printf("locate: haystack '%s'\n",buffer);
 //printf("locate: needle '%s'\n",needle);
         /* is the string present? Y: write to primary, N: secondary   */
-        if (strstr(buffer,needle) != NULL)
+        if (found(buffer,buflen,needle,nlen))
 #endif
-        rc = xfl_output(pop,buffer,buflen);   /* send it down primary */
-        else
-        rc = xfl_output(pos,buffer,buflen); /* send it down secondary */
+        rc = xfl_output(pop,(void*) buffer,buflen);      /* primary */
+        else if (pos != NULL)
+        rc = xfl_output(pos,(void*) buffer,buflen);    /* secondary */
+        else rc = 0;     /* no secondary stream: discard the record */
         if (rc < 0) break;
 
 
@@ -0,0 +1,425 @@
+/*
+ *        Name: parallel.c (C program source)
+ *              POSIX Pipelines PARALLEL stage
+ *        Date: 2026-10-17 (Sat)
+ *
+ *      parallel n [KEY range] stage [args]
+ *
+ * Runs n copies of a stage side by side. The launcher stacks the
+ * copies and connects copy k to our output stream k and input stream
+ * k (see xfl_planparallel() in xfllib.c), so here we only deal the
+ * records to the copies and merge what they write back into one
+ * stream.
+ *
+ * Records are dealt round-robin, or with KEY by a hash of the columns
+ * in range, so that records with the same key all go to one copy.
+ * Each record dealt is numbered, and each record a copy writes is
+ * tagged with the number of the record that copy was holding at the
+ * time. The output is then written in the order of the input records,
+ * as if there were only the one copy of the stage.
+ *
+ * That works for stages which do not delay the record: they peek at
+ * a record, write what they will for it, and only then consume it.
+ * The launcher keeps the copies' connectors lock-step for that reason.
+ * Output from other stages all comes through, but perhaps not in order.
+ *
+ * There is a thread to read the input, and for each copy one thread
+ * to feed it and one to collect from it. The main thread writes.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <xfl.h>
+
+static char _eyeball0[] = "XFL pipeline stage 'parallel'";
+
+/* a record dealt to a copy, or written by one                        */
+typedef struct PARREC {
+    struct PARREC *next;
+    long seq;               /* number of the input record it belongs to */
+    int len;
+    char *data;
+                      } PARREC;
+
+/* one copy of the stage                                              */
+typedef struct PARCOPY {
+    struct PARALLEL *pl;
+    struct PIPECONN *po;                /* to the copy (its input) */
+    struct PIPECONN *pi;            /* from the copy (its output) */
+    struct PARREC *todo, **todoz;      /* dealt, not yet handed over */
+    struct PARREC *outq, **outqz;   /* written, not yet passed along */
+    long cur;        /* record the copy is holding, or last one held */
+    long done;          /* records up through this one are consumed */
+    int ended;                      /* the copy has closed its output */
+    int started;           /* threads for it: 1 the feeder, 2 both */
+    pthread_t feeder, collector;
+                       } PARCOPY;
+
+/* all of it, shared by the threads under the one lock                */
+typedef struct PARALLEL {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;         /* one will do, there is little to it */
+    int n;                                        /* number of copies */
+    struct PARCOPY *copy;
+    int *deal;              /* copy each record in flight was dealt to */
+    long window;                /* records in flight, at most */
+    long dealt;                           /* records read and dealt */
+    long emitted;              /* records all passed along, in order */
+    int eof;                                    /* no more to deal */
+    int quit;                            /* our output was severed */
+    int kfrom, kto;   /* KEY columns, from zero for none, to zero for end */
+    long next;                            /* round-robin, if no KEY */
+    struct PIPECONN *pi;
+                        } PARALLEL;
+
+/* ------------------------------------------------------------------ */
+/* which copy gets this record                                         */
+static int parallel_deal(PARALLEL*pl,const char*buf,int len)
+  { unsigned int h;
+    int i, e;
+
+    if (pl->kfrom == 0) return pl->next++ % pl->n;
+
+    /* FNV-1a over the key columns, as much of them as the record has */
+    h = 2166136261u;
+    e = (pl->kto == 0 || pl->kto > len) ? len : pl->kto;
+    for (i = pl->kfrom - 1; i < e; i++)
+      { h ^= (unsigned char) buf[i]; h *= 16777619u; }
+    return h % pl->n;
+  }
+
+/* ------------------------------------------------------------------ */
+/* read our input and deal it to the copies, a window at a time        */
+static void *parallel_reader(void*arg)
+  { static char _eyecatcher[] = "XFL pipeline stage 'parallel' reader";
+    PARALLEL *pl = arg;
+    PARCOPY *c;
+    PARREC *r;
+    char *buf = NULL;
+    int size = 0, rc, j;
+
+    while (1)
+      { rc = xfl_peekto_alloc(pl->pi,(void**) &buf,&size);
+        if (rc < 0) break;
+        r = malloc(sizeof(PARREC));
+        if (r == NULL) break;
+        r->data = buf; r->len = rc; r->next = NULL;
+        j = parallel_deal(pl,buf,rc);
+
+        pthread_mutex_lock(&pl->lock);
+        while (pl->dealt - pl->emitted >= pl->window && !pl->quit)
+            pthread_cond_wait(&pl->cond,&pl->lock);
+        if (pl->quit) { pthread_mutex_unlock(&pl->lock); free(r); break; }
+        r->seq = ++pl->dealt;
+        pl->deal[r->seq % pl->window] = j;
+        c = &pl->copy[j];
+        *c->todoz = r; c->todoz = &r->next;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->lock);
+
+        buf = NULL; size = 0;             /* the record has it now */
+        rc = xfl_readto(pl->pi,NULL,0);
+        if (rc < 0) break;
+      }
+    free(buf);
+
+    pthread_mutex_lock(&pl->lock);
+    pl->eof = 1;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+  }
+
+/* ------------------------------------------------------------------ */
+/* hand one copy its records; the output returns once it consumes one  */
+static void *parallel_feeder(void*arg)
+  { static char _eyecatcher[] = "XFL pipeline stage 'parallel' feeder";
+    PARCOPY *c = arg;
+    PARALLEL *pl = c->pl;
+    PARREC *r;
+    int rc, gone;
+
+    gone = (c->po == NULL);
+    pthread_mutex_lock(&pl->lock);
+    while (1)
+      { while (c->todo == NULL && !pl->eof)
+            pthread_cond_wait(&pl->cond,&pl->lock);
+        r = c->todo;
+        if (r == NULL) break;        /* end of input, and all handed over */
+        c->todo = r->next;
+        if (c->todo == NULL) c->todoz = &c->todo;
+        c->cur = r->seq;
+        pthread_mutex_unlock(&pl->lock);
+
+        /* a copy which has gone away just has its records dropped   */
+        if (!gone)
+          { rc = xfl_output(c->po,r->data,r->len);
+            if (rc < 0) gone = 1; }
+        free(r->data);
+        free(r);
+
+        pthread_mutex_lock(&pl->lock);
+        c->done = c->cur;
+        pthread_cond_broadcast(&pl->cond);
+      }
+    pthread_mutex_unlock(&pl->lock);
+
+    if (c->po != NULL) xfl_sever(c->po);
+    return NULL;
+  }
+
+/* ------------------------------------------------------------------ */
+/* take what one copy writes, tagged with the record it belongs to     */
+static void *parallel_collector(void*arg)
+  { static char _eyecatcher[] = "XFL pipeline stage 'parallel' collector";
+    PARCOPY *c = arg;
+    PARALLEL *pl = c->pl;
+    PARREC *r;
+    char *buf = NULL;
+    int size = 0, rc;
+
+    while (c->pi != NULL)
+      { rc = xfl_peekto_alloc(c->pi,(void**) &buf,&size);
+        if (rc < 0) break;
+        r = malloc(sizeof(PARREC));
+        if (r == NULL) break;
+        r->data = buf; r->len = rc; r->next = NULL;
+
+        pthread_mutex_lock(&pl->lock);
+        r->seq = c->cur;
+        *c->outqz = r; c->outqz = &r->next;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->lock);
+
+        buf = NULL; size = 0;
+        rc = xfl_readto(c->pi,NULL,0);
+        if (rc < 0) break;
+      }
+    free(buf);
+
+    pthread_mutex_lock(&pl->lock);
+    c->ended = 1;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+  }
+
+/* ------------------------------------------------------------------ */
+/* pass along one record a copy wrote; called and returns with lock    */
+static void parallel_emit(PARALLEL*pl,PARCOPY*c,PIPECONN*po)
+  { PARREC *r;
+    int rc;
+
+    r = c->outq;
+    c->outq = r->next;
+    if (c->outq == NULL) c->outqz = &c->outq;
+    pthread_mutex_unlock(&pl->lock);
+
+    rc = 0;
+    if (!pl->quit) rc = xfl_output(po,r->data,r->len);
+    free(r->data);
+    free(r);
+
+    pthread_mutex_lock(&pl->lock);
+    if (rc < 0)    /* nobody wants it: stop dealing, drain the copies */
+      { pl->quit = 1;
+        pthread_cond_broadcast(&pl->cond); }
+  }
+
+/* ------------------------------------------------------------------ */
+/* parse "m", "m-n", "m-*", or "m.len" into from and to columns        */
+static int parallel_range(char*s,int*from,int*to)
+  { char *q;
+    long m, n;
+
+    m = strtol(s,&q,10);
+    if (q == s || m < 1) return -1;
+    n = m;
+    if (*q == '-' && q[1] == '*' && q[2] == 0x00) n = 0; else
+    if (*q == '-' || *q == '.')
+      { char c = *q;
+        s = q + 1;
+        n = strtol(s,&q,10);
+        if (q == s || n < 1) return -1;
+        if (c == '.') n = m + n - 1;
+        if (n < m) return -1; }
+    else if (*q != 0x00) return -1;
+    *from = m; *to = n;
+    return 0;
+  }
+
+/* ------------------------------------------------------------------ */
+int main(int argc,char*argv[])
+  { static char _eyecatcher[] = "XFL pipeline stage 'parallel' main()";
+    int rc, j;
+    char *args, *p, *q, *msgv[3], em[16];
+    long seq;
+    struct PIPECONN *pc, *po;
+    PARALLEL pl0, *pl = &pl0;
+    PARCOPY *c;
+    pthread_t reader;
+
+    /* initialize this stage                                          */
+    rc = xfl_stagestart(&pc);
+    if (rc < 0) return 1;
+
+    /* string-up the command line arguments                           */
+    args = xfl_argcat(argc,argv);
+    if (args == NULL) /* there was an error, then */ return 1;
+
+    memset(pl,0x00,sizeof(pl0));
+
+    /* the number of copies                                           */
+    p = args;
+    while (*p == ' ' || *p == '\t') p++;
+    pl->n = strtol(p,&q,10);
+    if (q == p || (*q != ' ' && *q != '\t' && *q != 0x00))
+      { q = p;
+        while (*q != ' ' && *q != '\t' && *q != 0x00) q++;
+        *q = 0x00; msgv[1] = p;
+        xfl_error(58,2,msgv,"PAR");     /* Decimal number expected */
+        return 1; }
+    if (pl->n < 1 || pl->n > XFL_PARALLEL_MAX)
+      { sprintf(em,"%d",pl->n); msgv[1] = em;
+        xfl_error(66,2,msgv,"PAR");  /* Number &1 is outside the range */
+        return 1; }
+
+    /* and the key, if records are to be dealt by one                 */
+    p = q;
+    while (*p == ' ' || *p == '\t') p++;
+    if (strncasecmp(p,"KEY",3) == 0 && (p[3] == ' ' || p[3] == '\t'))
+      { p += 3;
+        while (*p == ' ' || *p == '\t') p++;
+        q = p;
+        while (*q != ' ' && *q != '\t' && *q != 0x00) q++;
+        if (*q != 0x00) *q++ = 0x00;
+        if (parallel_range(p,&pl->kfrom,&pl->kto) < 0)
+          { msgv[1] = p;
+            xfl_error(54,2,msgv,"PAR");    /* Range "&1" not valid */
+            return 1; } }
+
+    /* the rest names the stage, which the launcher already stacked   */
+
+    pl->window = 2 * pl->n;  /* enough to keep every copy busy */
+    pl->deal = malloc(pl->window * sizeof(int));
+    pl->copy = malloc(pl->n * sizeof(PARCOPY));
+    if (pl->deal == NULL || pl->copy == NULL) return 1;
+    pthread_mutex_init(&pl->lock,NULL);
+    pthread_cond_init(&pl->cond,NULL);
+
+    /* snag the connectors here, where the stream tables are          */
+    pl->pi = xfl_input_stream(0);
+    po = xfl_output_stream(0);
+    if (po == NULL) pl->quit = 1;
+    for (j = 0; j < pl->n; j++)
+      { c = &pl->copy[j];
+        memset(c,0x00,sizeof(PARCOPY));
+        c->pl = pl;
+        c->po = xfl_output_stream(j+1);
+        c->pi = xfl_input_stream(j+1);
+        c->todoz = &c->todo;
+        c->outqz = &c->outq; }
+
+    rc = 0;
+    for (j = 0; j < pl->n && rc == 0; j++)
+      { c = &pl->copy[j];
+        rc = pthread_create(&c->feeder,NULL,parallel_feeder,c);
+        if (rc != 0) break;
+        c->started = 1;
+        rc = pthread_create(&c->collector,NULL,parallel_collector,c);
+        if (rc == 0) c->started = 2; }
+    if (rc == 0)
+      { if (pl->pi != NULL)
+            rc = pthread_create(&reader,NULL,parallel_reader,pl);
+        else pl->eof = 1; }
+
+    /* short of threads: nothing has been dealt yet, so end the input */
+    /* of every copy, wait for those threads which did start, and go  */
+    if (rc != 0)
+      { sprintf(em,"%d",rc); msgv[1] = em;
+        msgv[2] = "pthread_create()";
+        xfl_error(303,3,msgv,"PAR");     /* Return code &1 from &2 */
+        pthread_mutex_lock(&pl->lock);
+        pl->eof = pl->quit = 1;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->lock);
+        for (j = 0; j < pl->n; j++)
+          { c = &pl->copy[j];
+            if (c->started < 1 && c->po != NULL) xfl_sever(c->po);
+            if (c->started < 2 && c->pi != NULL) xfl_sever(c->pi);
+            if (c->started >= 1) pthread_join(c->feeder,NULL);
+            if (c->started >= 2) pthread_join(c->collector,NULL);
+            while (c->outq != NULL)
+              { PARREC *r = c->outq;
+                c->outq = r->next; free(r->data); free(r); } }
+        if (pl->pi != NULL) xfl_sever(pl->pi);
+        if (po != NULL) xfl_sever(po);
+        free(pl->copy);
+        free(pl->deal);
+        free(args);
+        return 1; }
+
+    /* pass along what the copies write, one input record at a time:  */
+    /* whatever belongs to it until its copy has consumed it           */
+    pthread_mutex_lock(&pl->lock);
+    seq = 1;
+    while (1)
+      { if (seq > pl->dealt)
+          { if (pl->eof) break;
+            pthread_cond_wait(&pl->cond,&pl->lock);
+            continue; }
+        c = &pl->copy[pl->deal[seq % pl->window]];
+        if (c->outq != NULL && c->outq->seq <= seq)
+          { parallel_emit(pl,c,po);
+            continue; }
+        if (c->done >= seq)
+          { pl->emitted = seq++;
+            pthread_cond_broadcast(&pl->cond);
+            continue; }
+        pthread_cond_wait(&pl->cond,&pl->lock);
+      }
+
+    /* then anything the copies write at end of file, copy by copy    */
+    for (j = 0; j < pl->n; j++)
+      { c = &pl->copy[j];
+        while (c->outq != NULL || !c->ended)
+          { if (c->outq != NULL) parallel_emit(pl,c,po);
+            else pthread_cond_wait(&pl->cond,&pl->lock); } }
+    pthread_mutex_unlock(&pl->lock);
+
+    if (pl->pi != NULL) pthread_join(reader,NULL);
+    for (j = 0; j < pl->n; j++)
+      { pthread_join(pl->copy[j].feeder,NULL);
+        pthread_join(pl->copy[j].collector,NULL); }
+
+    free(pl->copy);
+    free(pl->deal);
+    free(args);
+
+    /* terminate this stage cleanly                                   */
+    rc = xfl_stagequit(pc);
+    if (rc < 0) return 1;
+
+    return 0;
+  }
+
+/*
+//MD
+//MD* parallel
+//MD
+//MDUse the `parallel` stage to run several copies of a stage at once.
+//MD
+//MD    parallel n [KEY range] stage [args]
+//MD
+//MDRecords are dealt to the `n` copies round-robin,
+//MDor with `KEY` so that records with the same columns go to the same copy.
+//MDWhat the copies write comes out in the order of the input records,
+//MDprovided the stage does not delay the record.
+//MD
+ */
+
+
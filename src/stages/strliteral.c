@@ -9,6 +9,7 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <xfl.h>
@@ -18,8 +19,8 @@ static char _eyeball0[] = "XFL pipeline stage 'strliteral'";
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'strliteral' main()";
-    int i, buflen, rc, argl;
-    char buffer[4096], *args, *argp, delim, *argq;
+    int i, buflen, bufsize, rc, argl;
+    char *buffer, *args, *argp, delim, *argq;
     struct PIPECONN *pc, *pi, *po, *pn;
 
     /* initialize this stage                                          */
@@ -57,11 +58,11 @@ int main(int argc,char*argv[])
 
     /* proper behavior: once we have written the literal to the       *
      * output, we then copy all input records, if any, to the output  */
+    buffer = NULL; bufsize = 0;     /* grows to fit records as needed */
     if (pi != NULL) while (1)
       {
         /* perform a PEEKTO and see if there is a record ready        */
-        buflen = sizeof(buffer) - 1;
-        rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ buflen = rc;
 
         /* write the record to our primary output stream              */
@@ -72,6 +73,7 @@ int main(int argc,char*argv[])
         rc = xfl_readto(pi,NULL,0);   /* consume record after sending */
         if (rc < 0) break;
       }
+    free(buffer);
     if (rc < 0) return 1;
 
     /* terminate this stage cleanly                                   */
@@ -30,8 +30,8 @@ static char _eyeball0[] = "XFL pipeline stage 'var'";
 /* ------------------------------------------------------------------ */
 int main(int argc,char*argv[])
   { static char _eyecatcher[] = "XFL pipeline stage 'var' main()";
-    int rc, l, buflen;
-    char *p, *q, *args, var[256], *val, *msgv[4], em[16], buffer[4096];
+    int rc, l, buflen, bufsize;
+    char *p, *q, *args, var[256], *val, *msgv[4], em[16], *buffer;
     struct PIPECONN *pc, *pi, *po, *pn;
 
     /* initialize this stage                                          */
@@ -65,6 +65,8 @@ int main(int argc,char*argv[])
     /* remember to free the strung-up arguments buffer                */
     free(args);
 
+    buffer = NULL; bufsize = 0;     /* grows to fit records as needed */
+
     /* if first stage then read the variable and write its value      */
     if (pi == NULL)
       {
@@ -91,8 +93,7 @@ int main(int argc,char*argv[])
 /*      but that can't happen without special arrangements            */
 
         /* perform a PEEKTO and see if there is a record ready        */
-        buflen = sizeof(buffer) - 1;
-        rc = xfl_peekto(pi,buffer,buflen);            /* sip on input */
+        rc = xfl_peekto_alloc(pi,(void**) &buffer,&bufsize);     /* sip */
         if (rc < 0) break; /* else */ buflen = rc;
 
         /* write the record to our primary output stream              */
@@ -106,6 +107,7 @@ int main(int argc,char*argv[])
       }
 
 //  if (rc < 0) return 1;
+    free(buffer);
 
     /* terminate this stage cleanly                                   */
     rc = xfl_stagequit(pc);
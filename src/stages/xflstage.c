@@ -0,0 +1,70 @@
+/*
+ *        Name: xflstage.c (C program source)
+ *              POSIX Pipelines multicall stage program
+ *        Date: 2026-10-17 (Sat)
+ *
+ * Every stage which comes with Ductwork, linked into one program.
+ * The stage to run is the name the program was started by (argv[0]),
+ * which is how the launcher starts it, or else the first argument:
+ *
+ *      xflstage locate /string/
+ *
+ * Each stage source is compiled with main() renamed xfl_stage_verb.
+ * One program means one executable to map and relocate for all of
+ * the stages of a pipeline instead of one per stage.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <xfl.h>
+
+static char _eyeball0[] = "XFL multicall stage program";
+
+/* the stages are listed in xflstages.h, as for xfl_verbs in xfllib.c */
+/* and MULTICALL in the makefile; aliases and abbreviations are       */
+/* resolved by xfl_stageverb()                                        */
+#define XFL_STAGE(verb,min) extern int xfl_stage_##verb(int,char*[]);
+#include <xflstages.h>
+
+static struct XFLSTAGE {
+    char *verb;
+    int (*stagemain)(int,char*[]);
+                       } stagetab[] = {
+#define XFL_STAGE(verb,min) { #verb, xfl_stage_##verb },
+#include <xflstages.h>
+    { NULL,         NULL } };
+
+/* ------------------------------------------------------------------ */
+int main(int argc,char*argv[])
+  { static char _eyecatcher[] = "XFL multicall stage program main()";
+    char *verb, *stage, *msgv[2];
+    int i;
+
+    /* the name we were started by, less any directory                */
+    verb = strrchr(argv[0],'/');
+    if (verb != NULL) verb++; else verb = argv[0];
+
+    /* started by our own name, so the stage is the first argument    */
+    if (strcmp(verb,"xflstage") == 0)
+      { if (argc < 2)
+          { /* 0011 E Null or blank parameter list found */
+            msgv[1] = "";
+            xfl_error(11,2,msgv,"XFL");
+            return 1; }
+        argc--; argv++; verb = argv[0]; }
+
+    stage = xfl_stageverb(verb);
+    if (stage == NULL) stage = verb;
+
+    for (i = 0; stagetab[i].verb != NULL; i++)
+      if (strcmp(stage,stagetab[i].verb) == 0)
+        return stagetab[i].stagemain(argc,argv);
+
+    /* 0027 E Entry point &1 not found */
+    msgv[1] = verb;
+    xfl_error(27,2,msgv,"XFL");
+    return 1;
+  }
+
+
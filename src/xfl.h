@@ -10,15 +10,28 @@
 
 #ifndef _XFLLIB_H
 
+#include <sys/uio.h>              /* struct iovec for the vector calls */
+
 //static char *_xfl_version = "XFL 1.0.4";
 #define  XFL_VERSION  (((1) << 24) + ((0) << 16) + ((4) << 8) + (0))
 //static int xfl_version = XFL_VERSION;
 
+/* level of the pipe protocol spoken by this library (see Protocol.md) */
+#define     XFL_PROTOCOL        5
+
 /* the following mnemonics represent bits in the flag field           */
 #define     XFL_F_INPUT         0x0001
 #define     XFL_F_OUTPUT        0x0002
 #define     XFL_F_KEEP          0x0010           /* keep during spawn */
 #define     XFL_F_SEVERED       0x0020           /* explicit or EPIPE */
+#define     XFL_F_SHMEM         0x0040  /* shared memory ring transport */
+#define     XFL_F_FTCHHDR       0x0080    /* FTCH reply owed or in flight */
+#define     XFL_F_FTCHDAT       0x0100  /* FTCH length read, content not */
+#define     XFL_F_SEQPKT        0x0200  /* one SOCK_SEQPACKET fd per side */
+#define     XFL_F_PART          0x0400     /* record being read in pieces */
+#define     XFL_F_STATHDR       0x0800    /* STAT reply owed or in flight */
+#define     XFL_F_READY         0x1000  /* xfl_wait_any() saw a record */
+#define     XFL_F_THREAD        0x2000 /* handed to a stage thread */
 
 /* the following mnemonics are simple numeric but must be unique      */
 #define     XFL_E_NONE          0
@@ -31,7 +44,20 @@
 #define     XFL_E_2756          2756  /* Too many operands. */
 #define     XFL_E_2811          2811  /* A stream with the stream identifier specified is already defined. */
 
-/*          XFL_MAX_STREAMS  16       */
+/* most pieces one record may be scattered into or gathered from      */
+#define     XFL_IOV_MAX         64
+
+/* most records moved in one exchange by the batch calls              */
+#define     XFL_BATCH_MAX       1024
+
+/* most a data pipe is grown to for large records (Linux default max) */
+#define     XFL_PIPE_MAX        1048576
+
+/* input connectors xfl_wait_any() watches without allocating more   */
+#define     XFL_WAIT_MAX        64
+
+/* most copies of a stage the "parallel" stage will deal records to   */
+#define     XFL_PARALLEL_MAX    64
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,12 +84,36 @@ typedef struct PIPECONN {
     /* nothing has happened yet. So there is no "record zero".        */
 
     void *buff;        /* optional buffer for shared memory transfers */
+                     /* (points to the ring mapping when XFL_F_SHMEM) */
+                   /* (else may hold a record for xfl_peekto_part()) */
+                       /* (or the record lent out by xfl_peekref()) */
     void *glob;                                        /* global area */
     void *prev;                /* pointer to previous struct in chain */
     void *next;                /* pointer to next struct in the chain */
 
+    /* the following were added after 1.0.4, so they go at the end    */
+    int fdm;    /* memfd of shared memory ring, or -1 for pipes alone */
+    int plvl;      /* pipe protocol level the producer has advertised */
+    int plen;            /* length of the current record, when known */
+    int poff;      /* how much of it has been taken in pieces (see PART) */
+    int bsiz;       /* size of buff when it holds a staged record copy */
+    int pcap;   /* capacity of the data pipe, 0 not known, -1 fixed */
+
                         } PIPECONN;
 
+/* Binary header which precedes record content on the data channel   */
+/* (reply to "FTCH" from protocol level 3, and each record in a ring) */
+typedef struct XFLFRAME {
+    int len;                      /* length of the record content */
+    int seq;             /* record number, PIPECONN.rn of the producer */
+    int flag;                              /* frame flags, else zero */
+    int resv;          /* reserved, must be zero (except for BATCH) */
+                        } XFLFRAME;
+
+/* frame flags (XFLFRAME.flag) which may be seen on the data channel  */
+#define     XFL_FRAME_BATCH     0x0002   /* reply to BTCH, resv = count */
+#define     XFL_FRAME_EOF       0x0004    /* end of stream, len = -1 */
+
 /* This struct describes a stage. All stage structs should be chained */
 /* so that the launcher can bring them up and wait for them to exit.  */
 typedef struct PIPESTAGE {
@@ -76,18 +126,60 @@ typedef struct PIPESTAGE {
 //  int argc;
 //  char **argv;
     int  ipcc;                          /* input pipe connector count */
-    void *ipcv[16];              /* input pipe connector vector array */
+    void **ipcv;                 /* input pipe connector vector array */
     int  opcc;                         /* output pipe connector count */
-    void *opcv[16];             /* output pipe connector vector array */
+    void **opcv;                /* output pipe connector vector array */
     int  xpcc;                         /* COMMON pipe connector count */
-    void *xpcv[16];             /* COMMON pipe connector vector array */
+    void **xpcv;                /* COMMON pipe connector vector array */
+    int  pcvz;        /* room in each of the arrays (they grow alike) */
+    char *path;          /* executable for this stage, once found */
 
     int cpid;             /* PID of child process handling this stage */
+    int fuse;      /* run of stages it shares a process with, or zero */
 
     void *prev;                /* pointer to previous struct in chain */
     void *next;                /* pointer to next struct in the chain */
                          } PIPESTAGE;
 
+/* A parsed pipeline, made by xfl_plan() and never changed after.    */
+/* It is all one block, the strings held as offsets into it, so that  */
+/* it can be written to a file as it is and read back by xfl_planload. */
+typedef struct XFLPLAN {
+    unsigned int magic;                             /* XFL_PLAN_MAGIC */
+    unsigned int level;            /* XFL_PLAN_LEVEL, bumped on change */
+    unsigned int size;                  /* bytes in the whole block */
+    unsigned int hash;     /* xfl_planhash() of the text it came from */
+    int text, stagesep, endchar;     /* what it came from, as offsets */
+    int stagec;                          /* entries in the stage table */
+    int connc;                       /* entries in the connector table */
+                       } XFLPLAN;
+
+/* one stage of a plan, strings as offsets, -1 where there is none    */
+typedef struct XFLPLANSTAGE {
+    int label;
+    int verb;
+    int args;
+    int pnum;                /* pipeline it first appears in, from 1 */
+    int ipcc, opcc;                     /* streams in each direction */
+                            } XFLPLANSTAGE;
+
+/* one connector of a plan, from an output stream to an input stream  */
+typedef struct XFLPLANCONN {
+    int from, fromstream;             /* stage index and stream number */
+    int to, tostream;
+    int flag;                        /* XFL_PLAN_LOCKSTEP, else zero */
+                           } XFLPLANCONN;
+
+#define     XFL_PLAN_MAGIC      0x58464C50                   /* "XFLP" */
+#define     XFL_PLAN_LEVEL      1
+#define     XFL_PLAN_LOCKSTEP   0x0001   /* no window, whatever is set */
+
+/* the tables follow the header, then the strings                     */
+#define     XFL_PLAN_STAGE(pl)  ((XFLPLANSTAGE*) ((XFLPLAN*) (pl) + 1))
+#define     XFL_PLAN_CONN(pl)   ((XFLPLANCONN*) \
+                                 (XFL_PLAN_STAGE(pl) + (pl)->stagec))
+#define     XFL_PLAN_STR(pl,o)  ((o) < 0 ? NULL : (char*) (pl) + (o))
+
 /* --- function prototypes ------------------------------------------ */
 
 char*xfl_argcat(int,char*[]);     /* gather argc/argv into one string */
@@ -96,15 +188,43 @@ int xfl_error(int,int,char**,char*);      /* msgn, msgc, msgv, caller */
 int xfl_trace(int,int,char**,char*);      /* msgn, msgc, msgv, caller */
 int xfl_pipepair(PIPECONN*[]);             /* allocate an in/out pair */
 int xfl_getpipepart(PIPESTAGE**,char*);
+int xfl_pipepartconn(PIPESTAGE*,PIPECONN*);   /* add a connector to it */
+
+unsigned int xfl_planhash(char*,char*,char*);  /* text, stagesep, endchar */
+int xfl_plan(char*,char*,char*,XFLPLAN**);  /* text, stagesep, endchar */
+int xfl_plancheck(XFLPLAN*);   /* find every stage, without starting one */
+int xfl_planstages(XFLPLAN*);     /* stages and connectors to launch */
+int xfl_plansave(XFLPLAN*,char*);                   /* plan, filename */
+int xfl_planload(char*,XFLPLAN**);                  /* filename, &plan */
 
+int xfl_stagefind(char*,char*,int);     /* verb, path buffer, buflen */
+char *xfl_stageverb(char*);         /* full name of a supplied stage */
 int xfl_stagespawn(int,char*[],PIPECONN*[],PIPESTAGE*);
+int xfl_stagethread(int,char*[],PIPECONN*[],PIPESTAGE*);
+int xfl_stagejoin();                   /* wait for the stage threads */
+int xfl_stagefuse(PIPESTAGE*);      /* its run of stages, one process */
+int xfl_preload();       /* catalog and stage modules, ahead of time */
 
 /* --- function prototypes for stages ------------------------------- */
 
 int xfl_stagestart(PIPECONN**);           /* returns a pipeconn array */
+PIPECONN *xfl_input_stream(int);            /* input by stream number */
+PIPECONN *xfl_output_stream(int);          /* output by stream number */
+PIPECONN *xfl_stream(char*,int);    /* by stream identifier, direction */
+int xfl_streams(int);          /* how many streams in that direction */
 int xfl_peekto(PIPECONN*,void*,int);      /* pipeconn, buffer, buflen */
+int xfl_peekto_alloc(PIPECONN*,void**,int*);   /* pipeconn, &buf, &size */
+int xfl_peekto_part(PIPECONN*,void*,int); /* pipeconn, buffer, buflen */
+int xfl_peektov(PIPECONN*,const struct iovec*,int);  /* pc, iov, iovcnt */
+int xfl_peekref(PIPECONN*,const void**,int*);   /* pipeconn, &ptr, &len */
+int xfl_peekto_nowait(PIPECONN*,void*,int);  /* pipeconn, buffer, buflen */
+int xfl_wait_any(PIPECONN**,int,int);         /* pipeconns, n, timeout */
 int xfl_readto(PIPECONN*,void*,int);      /* pipeconn, buffer, buflen */
 int xfl_output(PIPECONN*,void*,int);      /* pipeconn, buffer, buflen */
+int xfl_outputv(PIPECONN*,const struct iovec*,int);  /* pc, iov, iovcnt */
+int xfl_readto_batch(PIPECONN*,struct iovec*,int,void*,int);
+                              /* pipeconn, recs, nrecs, buffer, buflen */
+int xfl_output_batch(PIPECONN*,const struct iovec*,int);  /* pc, recs, n */
 int xfl_sever(PIPECONN*);                   /* disconnect a connector */
 int xfl_stagequit(PIPECONN*);          /* releases the pipeconn array */
 
@@ -6,6 +6,10 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE             /* cpu_set_t and sched_setaffinity() */
+#endif
+
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +20,57 @@
 #include <signal.h>
 #include <syslog.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <time.h>
+
+/* stages may also run as threads of the launcher (PIPEOPT_THREADS)  */
+/* in which case whatever belongs to one stage is kept per thread     */
+#if defined(__linux__) || defined(__FreeBSD__)
+#define XFL_THREADS
+#include <pthread.h>
+#include <dlfcn.h>
+#define XFL_TLS __thread
+#else
+#define XFL_TLS
+#endif
+
+/* stages may be placed on particular processors (PIPEOPT_AFFINITY)  */
+#ifdef __linux__
+#define XFL_AFFINITY
+#include <sched.h>
+#endif
+
+/* stages are launched with posix_spawn() where it is to be had      */
+#if defined(_POSIX_SPAWN) && _POSIX_SPAWN > 0
+#define XFL_SPAWN
+#include <spawn.h>
+#endif
+extern char **environ;
+
+/* shared memory transport needs memfd_create() and futex()           */
+#ifdef __linux__
+#define XFL_SHMEM
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/* pipe capacity can be changed on Linux (2.6.35 and up)              */
+#if defined(__linux__) && !defined(F_SETPIPE_SZ)
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+#endif
+
+/* the io_uring backend needs linked submissions (Linux 5.3 and up)   */
+#ifdef __linux__
+#include <linux/io_uring.h>
+#if defined(IOSQE_IO_LINK) && defined(SYS_io_uring_setup)
+#define XFL_URING
+#endif
+#endif
 
 #include "configure.h"
 /* defines PREFIX among other things*/
@@ -28,11 +83,26 @@ char *xmmprefix = PREFIX;
 /* static */ int xfl_version = XFL_VERSION;
 /* static */ struct PIPECONN *xfl_pipeconn = NULL;
 /* static */ struct PIPESTAGE *xfl_pipestage = NULL;
+/* static */ int xfl_daemonfd = -1;  /* daemon client, none for stages */
 
 
-static int xfl_errno = XFL_E_NONE;
+static XFL_TLS int xfl_errno = XFL_E_NONE;
 static int xfl_dotrace = 0;
 
+/* PIPEOPT_SPIN: microseconds to spin before sleeping, -1 not yet read */
+static XFL_TLS int xfl_spinus = -1;
+static XFL_TLS long xfl_spunhits = 0, xfl_spunouts = 0; /* hits/sleeps */
+
+#ifdef XFL_THREADS
+/* the message struct is shared, so one stage thread at a time        */
+static pthread_mutex_t xfl_msglock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static int xfl_msgsopen = 0;     /* the catalog is read once, not per call */
+
+/* connectors for a stage running as a thread (or forked from a warm  */
+/* launcher), else NULL for the PIPECONN environment variable         */
+static XFL_TLS char *xfl_stageconn = NULL;
+
 /* ---------------------------------------------------------------------
  *  This is a byte-at-a-time read function which attempts to consume
  *  a single line of text and no more.
@@ -61,6 +131,151 @@ ssize_t readl(int fd, void *buf, size_t count)
     return i;
   }
 
+/* ---------------------------------------------------------------------
+ *  Read exactly "count" bytes unless end-of-file or an error intervenes.
+ *  Pipes hand back large records in pieces, so we keep at it.
+ */
+static ssize_t xfl_readfull(int fd,void*buf,size_t count)
+  { size_t i;
+    ssize_t rc;
+
+    i = 0;
+    while (i < count)
+      {
+        rc = read(fd,(char*) buf + i,count - i);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0 && errno == ECONNRESET) break;   /* socket peer gone */
+        if (rc < 0) return rc;
+        if (rc == 0) break;                            /* end-of-file */
+        i = i + rc;
+      }
+    return i;
+  }
+
+/* ---------------------------------------------------------------------
+ *  Like xfl_readfull() but scatters into the pieces described by "vec",
+ *  starting "skip" bytes in. Pipes hand back large records in pieces.
+ */
+static ssize_t xfl_readfullv(int fd,const struct iovec*vec,int cnt,
+                                                  size_t skip,size_t count)
+  { struct iovec iov[XFL_IOV_MAX];
+    size_t i, off, len;
+    ssize_t rc;
+    int k, n;
+
+    i = 0;
+    while (i < count)
+      {
+        /* describe what is still wanted, from "skip + i" bytes in    */
+        off = skip + i; len = count - i; n = 0;
+        for (k = 0; k < cnt && len > 0; k++)
+          { if (off >= vec[k].iov_len) { off = off - vec[k].iov_len; continue; }
+            iov[n].iov_base = (char*) vec[k].iov_base + off;
+            iov[n].iov_len = vec[k].iov_len - off;
+            if (iov[n].iov_len > len) iov[n].iov_len = len;
+            len = len - iov[n].iov_len; off = 0; n++; }
+
+        rc = readv(fd,iov,n);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0 && errno == ECONNRESET) break;   /* socket peer gone */
+        if (rc < 0) return rc;
+        if (rc == 0) break;                            /* end-of-file */
+        i = i + rc;
+      }
+    return i;
+  }
+
+/* ---------------------------------------------------------------------
+ *  PRODUCER SIDE
+ *  A record bigger than the data pipe has to be written in pieces, the
+ *  consumer waking for each one, so grow the pipe (in powers of two up
+ *  to XFL_PIPE_MAX) to hold the biggest record seen so far.
+ */
+static void xfl_pipegrow(PIPECONN*pc,int need)
+  {
+#ifdef F_SETPIPE_SZ
+    int size, rc;
+
+    if (pc->pcap < 0 || need <= pc->pcap) return;
+    if (pc->flag & XFL_F_SEQPKT) { pc->pcap = -1; return; }
+    if (pc->pcap == 0)
+      { rc = fcntl(pc->fdf,F_GETPIPE_SZ);
+        if (rc <= 0) { pc->pcap = -1; return; }
+        pc->pcap = rc;
+        if (need <= pc->pcap) return; }
+    if (pc->pcap >= XFL_PIPE_MAX) return;
+
+    for (size = pc->pcap; size < need && size < XFL_PIPE_MAX; size = size * 2);
+    if (size > XFL_PIPE_MAX) size = XFL_PIPE_MAX;
+    rc = fcntl(pc->fdf,F_SETPIPE_SZ,size);
+    if (rc > 0) pc->pcap = rc;
+           else pc->pcap = -1;     /* over the system limit: stop asking */
+#endif
+  }
+
+/* ------------------------------------------------------------ WRITEALL
+ *  writev() until all of it has gone, which a pipe need not take at
+ *  once (nor a write interrupted by a signal); moves along the vector
+ *  Returns: zero, or negative as writev() does
+ */
+static int xfl_writeall(int fd,struct iovec*iov,int n)
+  { int rc;
+    while (n > 0)
+      { rc = writev(fd,iov,n);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0) return rc;
+        while (n > 0 && rc >= iov->iov_len)
+          { rc = rc - iov->iov_len; iov++; n--; }
+        if (n > 0)
+          { iov->iov_base = (char*) iov->iov_base + rc;
+            iov->iov_len = iov->iov_len - rc; } }
+    return 0;
+  }
+
+/* ---------------------------------------------------------------------
+ *  PRODUCER SIDE
+ *  Send an optional frame header and then the record content, which
+ *  may be gathered from several pieces into one writev() (or a few).
+ *  A message socket limits the size of one message, so a large record
+ *  goes out in pieces, which the consumer gathers with xfl_readfull().
+ */
+#define  XFL_SEQPKT_MAX     65536          /* largest message we send */
+static int xfl_sendrec(PIPECONN*pc,struct XFLFRAME*fh,
+                                            const struct iovec*vec,int cnt)
+  { struct iovec iov[XFL_IOV_MAX+1];
+    int rc, n, k, hlen, total;
+    size_t off, len, room;
+
+    total = 0;
+    for (k = 0; k < cnt; k++) total = total + vec[k].iov_len;
+
+    n = hlen = 0;
+    if (fh != NULL)
+      { iov[0].iov_base = fh; iov[0].iov_len = hlen = sizeof(*fh); n = 1; }
+    else if (total == 0) return 0;            /* nothing to send at all */
+    xfl_pipegrow(pc,hlen + total);
+
+    k = 0; off = 0;
+    do {
+        room = total;
+        if (pc->flag & XFL_F_SEQPKT) room = XFL_SEQPKT_MAX - hlen;
+        while (k < cnt && room > 0 && n <= XFL_IOV_MAX)
+          { len = vec[k].iov_len - off;
+            if (len > room) len = room;
+            if (len > 0)
+              { iov[n].iov_base = (char*) vec[k].iov_base + off;
+                iov[n].iov_len = len; n++; }
+            room = room - len; off = off + len;
+            if (off == vec[k].iov_len) { k++; off = 0; } }
+        if (n == 0) break;
+        rc = xfl_writeall(pc->fdf,iov,n);
+        if (rc < 0) return rc;
+        n = hlen = 0;
+       } while (k < cnt);
+
+    return total;
+  }
+
 /* ---------------------------------------------------------------------
  *  NOTE: this routine allocates a string buffer
  *        which the caller must eventually free to avoid memory leaks.
@@ -114,7 +329,10 @@ int xfl_error(int msgn,int msgc,char*msgv[],char*caller)
     char msgbuf[256];
     int rc;
 
-    rc = xmopen("xfl",0,&xflmsgs);
+#ifdef XFL_THREADS
+    pthread_mutex_lock(&xfl_msglock);
+#endif
+    if (!xfl_msgsopen) xfl_msgsopen = (xmopen("xfl",0,&xflmsgs) == 0);
 
     /* some functions indicate the error with a negative number       */
     if (msgn < 0) msgn = 0 - msgn;   /* force message number positive */
@@ -136,6 +354,9 @@ int xfl_error(int msgn,int msgc,char*msgv[],char*caller)
 
     /* make the message */
     rc = xmmake(&xflmsgs);
+#ifdef XFL_THREADS
+    pthread_mutex_unlock(&xfl_msglock);
+#endif
     if (rc != 0) return rc;
 
     /* print it */
@@ -159,7 +380,10 @@ int xfl_trace(int msgn,int msgc,char*msgv[],char*caller)
         if (p != NULL && *p != 0x00) xfl_dotrace = 1; }
     if (xfl_dotrace == 0) return 0;
 
-    rc = xmopen("xfl",0,&xflmsgs);
+#ifdef XFL_THREADS
+    pthread_mutex_lock(&xfl_msglock);
+#endif
+    if (!xfl_msgsopen) xfl_msgsopen = (xmopen("xfl",0,&xflmsgs) == 0);
 
     /* some functions indicate the error with a negative number       */
     if (msgn < 0) msgn = 0 - msgn;   /* force message number positive */
@@ -181,6 +405,9 @@ int xfl_trace(int msgn,int msgc,char*msgv[],char*caller)
 
     /* make the message */
     rc = xmmake(&xflmsgs);
+#ifdef XFL_THREADS
+    pthread_mutex_unlock(&xfl_msglock);
+#endif
     if (rc != 0) return rc;
 
     /* log it */
@@ -189,6 +416,756 @@ int xfl_trace(int msgn,int msgc,char*msgv[],char*caller)
     return 0;
   }
 
+/* set while xfl_planstages() makes connectors which must not have   */
+/* records in flight, whatever PIPEOPT_WINDOW says                     */
+static int xfl_lockstep = 0;
+
+/* and while it makes connectors between fused stages, which are      */
+/* shared rings where the platform has them, whatever PIPEOPT_TRANSPORT */
+static int xfl_inring = 0;
+
+#ifdef XFL_SHMEM
+
+/* ---------------------------------------------------------------- SPIN
+ *  With PIPEOPT_SPIN=usec a side which must wait for the other first
+ *  keeps looking for up to that long, on the futex word of a shared ring
+ *  ("word" while it still holds "val") or else on the descriptor "fd".
+ *  On a dedicated core this saves the sleep and wake-up for each record.
+ *  Returns 1 if the wait is over, 0 if the caller should go to sleep.
+ */
+static int xfl_spin(int fd,unsigned int*word,unsigned int val)
+  { struct timespec t0, t1;
+    struct pollfd pf;
+    long spent;
+    int k;
+    char *p;
+
+    if (xfl_spinus < 0)
+      { p = getenv("PIPEOPT_SPIN");
+        xfl_spinus = (p != NULL && *p >= '0' && *p <= '9') ? atoi(p) : 0;
+        /* with a single processor the other side cannot run meanwhile */
+        if (sysconf(_SC_NPROCESSORS_ONLN) < 2) xfl_spinus = 0; }
+    if (xfl_spinus == 0) return 0;
+
+    pf.fd = fd; pf.events = POLLIN;
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    while (1)
+      {
+        /* look a few times between trips to the clock                */
+        for (k = 0; k < 64; k++)
+          { if (word != NULL)
+              { if (__atomic_load_n(word,__ATOMIC_ACQUIRE) != val)
+                  { xfl_spunhits++; return 1; }
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+              }
+            else
+              { pf.revents = 0;
+                if (poll(&pf,1,0) > 0) { xfl_spunhits++; return 1; } } }
+
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        spent = (t1.tv_sec - t0.tv_sec) * 1000000
+              + (t1.tv_nsec - t0.tv_nsec) / 1000;
+        if (spent >= xfl_spinus) break;
+      }
+
+    xfl_spunouts++;
+    return 0;
+  }
+
+/* -------------------------------------------------------------- PIPEWAIT
+ *  Spin for input on a pipe or socket, if asked to, before the caller
+ *  makes its blocking read. Nothing to do if the data is already there.
+ */
+static void xfl_pipewait(int fd)
+  { struct pollfd pf;
+
+    if (xfl_spinus == 0) return;
+    pf.fd = fd; pf.events = POLLIN; pf.revents = 0;
+    if (poll(&pf,1,0) > 0) return;
+    xfl_spin(fd,NULL,0);
+  }
+
+/* --------------------------------------------------------------- SHMEM
+ *  Shared memory transport: records travel through a ring in a memfd
+ *  segment which both sides of the connector map. The pipes remain
+ *  open, but only so that either side can tell when the other is gone,
+ *  and for a stage built before there was a ring, which never maps it:
+ *  a connector only uses the ring once both sides have said they will.
+ */
+#define  XFL_SHM_MAGIC      0x58464C52        /* "XFLR" as eyecatcher */
+#define  XFL_SHM_LEVEL      3                   /* ring protocol level */
+#define  XFL_SHM_HDRLEN     64          /* ring data follows the header */
+#define  XFL_SHM_RINGLEN    65536            /* initial ring data size */
+#define  XFL_SHM_NAPTIME    100000000   /* nanoseconds per futex wait */
+#define  XFL_SHM_AGREEMS    100    /* how long to wait for the other side */
+#define  XFL_SHM_UNSET      0     /* hdr mode: not yet agreed upon */
+#define  XFL_SHM_RING       1     /* hdr mode: both sides use the ring */
+#define  XFL_SHM_PIPE       2     /* hdr mode: both sides use the pipes */
+#define  XFL_SHM_PSEVER     0x0001      /* producer severed (hdr flag) */
+#define  XFL_SHM_CSEVER     0x0002      /* consumer severed (hdr flag) */
+#define  XFL_SHM_WRAP       0x0001   /* frame flag: continue at offset 0 */
+#define  XFL_SHM_ALIGN(n)   (((n) + 7) & ~7)
+
+/* this header sits at offset zero of the shared segment              */
+typedef struct XFLSHMHDR {
+    unsigned int magic;                /* eyecatcher and sanity check */
+    unsigned int level;                 /* protocol level of the ring */
+    unsigned int size;           /* size of ring data (after header) */
+    unsigned int flag;                    /* sever flags, one per side */
+    unsigned int pseq;           /* count of records posted (a futex) */
+    unsigned int cseq;         /* count of records consumed (a futex) */
+    unsigned int pwait;          /* producer is sleeping on cseq word */
+    unsigned int cwait;          /* consumer is sleeping on pseq word */
+    unsigned int head;          /* ring offset where producer writes */
+    unsigned int tail;           /* ring offset where consumer reads */
+    unsigned int window;     /* records the producer may have in flight */
+    unsigned int pattach;       /* producer has mapped it (a futex) */
+    unsigned int cattach;       /* consumer has mapped it (a futex) */
+    unsigned int mode;      /* ring or pipes, settled by whoever is first */
+                         } XFLSHMHDR;
+
+/* each record in the ring is preceded by an XFLFRAME, see xfl.h     */
+
+/* per-process view of the segment, hung off of PIPECONN.buff         */
+typedef struct XFLSHM {
+    struct XFLSHMHDR *hdr;              /* where we have it mapped */
+    size_t mlen;                         /* how much we have mapped */
+                      } XFLSHM;
+
+/* ----------------------------------------------------------- SHMCREATE
+ *  Called by xfl_pipepair() in the launcher. Returns a memfd holding
+ *  an initialized ring, or negative if shared memory is not available.
+ */
+static int xfl_shmcreate()
+  { static char _eyecatcher[] = "xfl_shmcreate()";
+    int fd, rc;
+    char *p;
+    struct XFLSHMHDR *hdr;
+
+    /* the user can insist on plain pipes, for comparison or debugging */
+    p = getenv("PIPEOPT_TRANSPORT");
+    if (p != NULL && strcasecmp(p,"PIPE") == 0 && !xfl_inring) return -1;
+
+    fd = syscall(SYS_memfd_create,"xfl",0);
+    if (fd < 0) return -1;
+
+    rc = ftruncate(fd,XFL_SHM_HDRLEN + XFL_SHM_RINGLEN);
+    if (rc < 0) { close(fd); return -1; }
+
+    hdr = mmap(NULL,XFL_SHM_HDRLEN,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    if (hdr == MAP_FAILED) { close(fd); return -1; }
+
+    memset(hdr,0x00,sizeof(struct XFLSHMHDR));
+    hdr->magic = XFL_SHM_MAGIC;
+    hdr->level = XFL_SHM_LEVEL;
+    hdr->size = XFL_SHM_RINGLEN;
+
+    /* zero keeps the strict "does not delay the record" lock-step     */
+    p = getenv("PIPEOPT_WINDOW");
+    if (p != NULL && *p >= '0' && *p <= '9' && !xfl_lockstep)
+        hdr->window = atoi(p);
+
+    munmap(hdr,XFL_SHM_HDRLEN);   /* the launcher itself does not use it */
+
+    return fd;
+  }
+
+/* ----------------------------------------------------------- SHMATTACH
+ *  Called by xfl_stagestart() for each connector which came with a
+ *  memfd. Maps the segment, hangs it off of the connector, and tells
+ *  the other side. A ring of some other level is left to the pipes.
+ */
+static int xfl_shmattach(PIPECONN*pc)
+  { static char _eyecatcher[] = "xfl_shmattach()";
+    struct stat sb;
+    struct XFLSHM *sm;
+    unsigned int *w;
+    void *m;
+
+    if (fstat(pc->fdm,&sb) < 0) return -1;
+
+    m = mmap(NULL,sb.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,pc->fdm,0);
+    if (m == MAP_FAILED) return -1;
+    if (((struct XFLSHMHDR*)m)->magic != XFL_SHM_MAGIC
+     || ((struct XFLSHMHDR*)m)->level != XFL_SHM_LEVEL)
+      { munmap(m,sb.st_size); return 0; }
+
+    sm = malloc(sizeof(struct XFLSHM));
+    if (sm == NULL) { munmap(m,sb.st_size); return -1; }
+    sm->hdr = m;
+    sm->mlen = sb.st_size;
+
+    pc->buff = sm;
+    pc->flag |= XFL_F_SHMEM;
+
+    /* let the other side know that we can use the ring               */
+    w = (pc->flag & XFL_F_INPUT) ? &sm->hdr->cattach : &sm->hdr->pattach;
+    __atomic_store_n(w,1,__ATOMIC_SEQ_CST);
+    syscall(SYS_futex,w,FUTEX_WAKE,1,NULL,NULL,0);
+    return 0;
+  }
+
+/* ------------------------------------------------------------ SHMREMAP
+ *  The producer grows the ring for records bigger than it. The other
+ *  side notices the new size in the header and maps the segment again.
+ */
+static int xfl_shmremap(PIPECONN*pc)
+  { struct XFLSHM *sm;
+    size_t mlen;
+    void *m;
+
+    sm = pc->buff;
+    mlen = XFL_SHM_HDRLEN + (size_t) sm->hdr->size;
+    if (mlen <= sm->mlen) return 0;
+
+    m = mmap(NULL,mlen,PROT_READ|PROT_WRITE,MAP_SHARED,pc->fdm,0);
+    if (m == MAP_FAILED) { perror("xfl_shmremap(): mmap()"); return -1; }
+    munmap(sm->hdr,sm->mlen);
+    sm->hdr = m;
+    sm->mlen = mlen;
+    return 0;
+  }
+
+/* ------------------------------------------------------------- SHMGROW
+ *  PRODUCER SIDE, only when the ring is empty
+ */
+static int xfl_shmgrow(PIPECONN*pc,unsigned int need)
+  { struct XFLSHMHDR *hdr;
+    unsigned int size;
+
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+    size = hdr->size;
+    while (size < need && size < 0x80000000) size = size * 2;
+    if (size < need) { errno = EFBIG; return -1; }
+
+    if (ftruncate(pc->fdm,XFL_SHM_HDRLEN + (off_t) size) < 0)
+      { perror("xfl_shmgrow(): ftruncate()"); return -1; }
+    hdr->size = size;
+    hdr->head = hdr->tail = 0;
+
+    return xfl_shmremap(pc);
+  }
+
+/* ------------------------------------------------------------- SHMPEER
+ *  Returns negative if the other side of the connector has gone away.
+ *  A hang-up on the otherwise idle pipe is our clue.
+ */
+static int xfl_shmpeer(PIPECONN*pc)
+  { struct pollfd pf;
+
+    if (pc->flag & XFL_F_INPUT) pf.fd = pc->fdf;
+                           else pf.fd = pc->fdr;
+    pf.events = POLLIN; pf.revents = 0;
+    if (poll(&pf,1,0) < 1) return 0;
+    if (pf.revents & (POLLHUP|POLLERR|POLLNVAL)) return -1;
+    return 0;
+  }
+
+/* ------------------------------------------------------------- SHMWAIT
+ *  Wait while the futex word still holds the value we last saw.
+ *  Returns negative if the connector was severed or the peer is gone.
+ */
+static int xfl_shmwait(PIPECONN*pc,unsigned int*word,unsigned int val,
+                                                    unsigned int*waiting)
+  { struct XFLSHMHDR *hdr;
+    struct timespec ts;
+    int rc;
+
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+    if (__atomic_load_n(word,__ATOMIC_ACQUIRE) == val
+     && xfl_spinus != 0 && xfl_spin(-1,word,val)) return 0;
+    while (__atomic_load_n(word,__ATOMIC_ACQUIRE) == val)
+      {
+        if (__atomic_load_n(&hdr->flag,__ATOMIC_ACQUIRE) != 0) return -1;
+
+        /* announce that we sleep, then look once more before we do   */
+        /* (a sever does not change the word, so look for that too)   */
+        __atomic_store_n(waiting,1,__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(word,__ATOMIC_SEQ_CST) != val)
+          { __atomic_store_n(waiting,0,__ATOMIC_RELAXED); break; }
+        if (__atomic_load_n(&hdr->flag,__ATOMIC_SEQ_CST) != 0)
+          { __atomic_store_n(waiting,0,__ATOMIC_RELAXED); return -1; }
+
+        ts.tv_sec = 0; ts.tv_nsec = XFL_SHM_NAPTIME;
+        rc = syscall(SYS_futex,word,FUTEX_WAIT,val,&ts,NULL,0);
+        __atomic_store_n(waiting,0,__ATOMIC_RELAXED);
+
+        /* periodically make sure the other side is still with us     */
+        if (rc < 0 && errno == ETIMEDOUT && xfl_shmpeer(pc) < 0) return -1;
+      }
+
+    return 0;
+  }
+
+/* ------------------------------------------------------------- SHMWAKE
+ *  Only make the system call when the other side said it is sleeping.
+ */
+static void xfl_shmwake(unsigned int*word,unsigned int*waiting)
+  {
+    if (__atomic_load_n(waiting,__ATOMIC_SEQ_CST))
+        syscall(SYS_futex,word,FUTEX_WAKE,1,NULL,NULL,0);
+  }
+
+/* ------------------------------------------------------------ SHMFRAME
+ *  CONSUMER SIDE
+ *  Find the frame at ring offset "tail", following a wrap marker back
+ *  to the start of the ring. Its real offset is returned in *at.
+ */
+static struct XFLFRAME *xfl_shmframe(struct XFLSHMHDR*hdr,unsigned int tail,
+                                                          unsigned int*at)
+  { struct XFLFRAME *f;
+
+    if (hdr->size - tail < sizeof(struct XFLFRAME)) tail = 0;
+    f = (struct XFLFRAME*) ((char*) hdr + XFL_SHM_HDRLEN + tail);
+    if (f->flag & XFL_SHM_WRAP)
+      { tail = 0;
+        f = (struct XFLFRAME*) ((char*) hdr + XFL_SHM_HDRLEN); }
+
+    *at = tail;
+    return f;
+  }
+
+/* ------------------------------------------------------------- SHMPEEK
+ *  CONSUMER SIDE
+ *  Waits for a record and returns its length, with the frame pointer
+ *  and its ring offset in *fp and *at, or negative at end of stream.
+ */
+static int xfl_shmpeek(PIPECONN*pc,struct XFLFRAME**fp,unsigned int*at)
+  { struct XFLSHMHDR *hdr;
+    struct XFLFRAME *f;
+
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+    if (xfl_shmwait(pc,&hdr->pseq,hdr->cseq,&hdr->cwait) < 0) return -1;
+
+    /* the producer may have grown the ring since we last looked      */
+    if (xfl_shmremap(pc) < 0) return -1;
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+
+    f = xfl_shmframe(hdr,hdr->tail,at);
+    *fp = f;
+    return f->len;
+  }
+
+/* ------------------------------------------------------------- SHMNEXT
+ *  CONSUMER SIDE
+ *  Consume the record at the tail of the ring, waiting for it if need be.
+ */
+static int xfl_shmnext(PIPECONN*pc)
+  { struct XFLSHMHDR *hdr;
+    struct XFLFRAME *f;
+    unsigned int at;
+
+    if (xfl_shmpeek(pc,&f,&at) < 0) return -1;
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+
+    hdr->tail = at + XFL_SHM_ALIGN(sizeof(struct XFLFRAME) + f->len);
+    __atomic_store_n(&hdr->cseq,hdr->cseq + 1,__ATOMIC_SEQ_CST);
+    xfl_shmwake(&hdr->cseq,&hdr->pwait);
+
+    return 0;
+  }
+
+/* ------------------------------------------------------------ SHMBATCH
+ *  CONSUMER SIDE
+ *  Copy out and consume as many records as are already in the ring,
+ *  up to "n" records and "buflen" bytes, waiting only for the first.
+ *  Returns the number of records, zero if not even the first record
+ *  fits, or negative at end of stream.
+ */
+static int xfl_shmbatch(PIPECONN*pc,struct iovec*iov,int n,
+                                                    void*buffer,int buflen)
+  { struct XFLSHMHDR *hdr;
+    struct XFLFRAME *f;
+    unsigned int at, avail, tail;
+    int k, used;
+
+    if (xfl_shmpeek(pc,&f,&at) < 0) return -1;
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+    avail = __atomic_load_n(&hdr->pseq,__ATOMIC_ACQUIRE) - hdr->cseq;
+
+    k = used = 0;
+    while (1)
+      {
+        if (f->len > buflen - used) break;
+        memcpy((char*) buffer + used,&f[1],f->len);
+        iov[k].iov_base = (char*) buffer + used; iov[k].iov_len = f->len;
+        used = used + f->len;
+        tail = at + XFL_SHM_ALIGN(sizeof(struct XFLFRAME) + f->len);
+        k++;
+        if (k >= n || k >= avail) break;
+        f = xfl_shmframe(hdr,tail,&at);
+      }
+    if (k == 0) return 0;
+
+    /* hand the space back and count them all consumed in one go      */
+    hdr->tail = tail;
+    __atomic_store_n(&hdr->cseq,hdr->cseq + k,__ATOMIC_SEQ_CST);
+    xfl_shmwake(&hdr->cseq,&hdr->pwait);
+
+    return k;
+  }
+
+/* ------------------------------------------------------------ SHMPLACE
+ *  PRODUCER SIDE
+ *  Gather one record into the ring. "*seqp" counts the records placed,
+ *  which may be ahead of those published when several go out together.
+ */
+static int xfl_shmplace(PIPECONN*pc,const struct iovec*vec,int cnt,
+                                            int buflen,unsigned int*seqp)
+  { struct XFLSHMHDR *hdr;
+    struct XFLFRAME *f;
+    unsigned int need, seq, done, head, tail, size;
+    int pos, k;
+    char *p;
+
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+    need = XFL_SHM_ALIGN(sizeof(struct XFLFRAME) + (unsigned int) buflen);
+    seq = *seqp;
+
+    /* find room in the ring, waiting for the consumer if it is full  */
+    while (1)
+      {
+        if (__atomic_load_n(&hdr->flag,__ATOMIC_ACQUIRE) & XFL_SHM_CSEVER)
+            return -1;
+        done = __atomic_load_n(&hdr->cseq,__ATOMIC_ACQUIRE);
+
+        if (done == seq && need > hdr->size)
+          { if (xfl_shmgrow(pc,need) < 0) return -1;
+            hdr = ((struct XFLSHM*)pc->buff)->hdr; }
+
+        head = hdr->head; tail = hdr->tail; size = hdr->size;
+        pos = -1;
+        if (done == seq)                      /* the ring is empty */
+          { if (need > size - head) hdr->head = hdr->tail = head = 0;
+            pos = head; }
+        else if (head > tail)
+          { if (need <= size - head) pos = head; else
+            if (need <= tail) pos = 0; }
+        else if (head < tail)
+          { if (need <= tail - head) pos = head; }
+        if (pos >= 0) break;
+
+        /* the consumer cannot make room for records it cannot see    */
+        if (hdr->pseq != seq)
+          { __atomic_store_n(&hdr->pseq,seq,__ATOMIC_SEQ_CST);
+            xfl_shmwake(&hdr->pseq,&hdr->cwait); }
+        if (xfl_shmwait(pc,&hdr->cseq,done,&hdr->pwait) < 0) return -1;
+      }
+
+    /* if we skip to the start then leave a marker where we left off  */
+    if (pos != head && size - head >= sizeof(struct XFLFRAME))
+      { f = (struct XFLFRAME*) ((char*) hdr + XFL_SHM_HDRLEN + head);
+        f->len = 0; f->seq = 0; f->flag = XFL_SHM_WRAP; }
+
+    f = (struct XFLFRAME*) ((char*) hdr + XFL_SHM_HDRLEN + pos);
+    f->len = buflen;
+    f->seq = pc->rn + 1;
+    f->flag = 0;
+    f->resv = 0;
+    for (p = (char*) &f[1], k = 0; k < cnt; k++)
+      { memcpy(p,vec[k].iov_base,vec[k].iov_len); p = p + vec[k].iov_len; }
+    hdr->head = pos + need;
+
+    *seqp = seq + 1;
+    return 0;
+  }
+
+/* ------------------------------------------------------------- SHMPOST
+ *  PRODUCER SIDE
+ *  Publish the records placed so far, then wait for the consumer to
+ *  take them, or with a window until no more than that many are left.
+ */
+static int xfl_shmpost(PIPECONN*pc,unsigned int seq)
+  { struct XFLSHMHDR *hdr;
+    unsigned int done;
+
+    /* publish the records and nudge the consumer if it is asleep     */
+    hdr = ((struct XFLSHM*)pc->buff)->hdr;
+    if (hdr->pseq != seq)
+      { __atomic_store_n(&hdr->pseq,seq,__ATOMIC_SEQ_CST);
+        xfl_shmwake(&hdr->pseq,&hdr->cwait); }
+
+    /* do not return until the consumer has taken the records         */
+    /* (or until they are within the window, if one was configured)   */
+    while (seq - (done = __atomic_load_n(&hdr->cseq,__ATOMIC_ACQUIRE))
+                                                            > hdr->window)
+        if (xfl_shmwait(pc,&hdr->cseq,done,&hdr->pwait) < 0) return -1;
+
+    return 0;
+  }
+
+/* ----------------------------------------------------------- SHMOUTPUT
+ *  PRODUCER SIDE
+ *  Gather the record into the ring, then wait for the consumer to take
+ *  it, or with a window just until no more than that many are outstanding.
+ */
+static int xfl_shmoutput(PIPECONN*pc,const struct iovec*vec,int cnt,
+                                                                int buflen)
+  { unsigned int seq;
+
+    seq = ((struct XFLSHM*)pc->buff)->hdr->pseq;  /* only we write it */
+    if (xfl_shmplace(pc,vec,cnt,buflen,&seq) < 0) return -1;
+    return xfl_shmpost(pc,seq);
+  }
+
+/* ------------------------------------------------------------ SHMSEVER
+ *  Flag our side as severed, wake the other side, and unmap the ring.
+ */
+static void xfl_shmsever(PIPECONN*pc)
+  { struct XFLSHM *sm;
+    struct XFLSHMHDR *hdr;
+
+    sm = pc->buff;
+    hdr = sm->hdr;
+    if (pc->flag & XFL_F_INPUT)
+         __atomic_or_fetch(&hdr->flag,XFL_SHM_CSEVER,__ATOMIC_SEQ_CST);
+    else __atomic_or_fetch(&hdr->flag,XFL_SHM_PSEVER,__ATOMIC_SEQ_CST);
+    syscall(SYS_futex,&hdr->pseq,FUTEX_WAKE,1,NULL,NULL,0);
+    syscall(SYS_futex,&hdr->cseq,FUTEX_WAKE,1,NULL,NULL,0);
+
+    munmap(sm->hdr,sm->mlen);
+    free(sm);
+    pc->buff = NULL;
+    pc->flag &= ~XFL_F_SHMEM;
+  }
+
+/* ------------------------------------------------------------- SHMDROP
+ *  Go back to the pipes for this connector: unmap the ring, quietly.
+ */
+static void xfl_shmdrop(PIPECONN*pc)
+  { struct XFLSHM *sm;
+
+    sm = pc->buff;
+    munmap(sm->hdr,sm->mlen);
+    free(sm);
+    pc->buff = NULL;
+    pc->flag &= ~XFL_F_SHMEM;
+    close(pc->fdm); pc->fdm = -1;
+  }
+
+/* ------------------------------------------------------------ SHMAGREE
+ *  Called by xfl_stagestart() once all of the rings are mapped.
+ *  Each ring is used only if the stage on the other side maps it too.
+ *  A stage which does not (built before the ring, or one which died)
+ *  is given a moment, then that connector settles on the pipes.
+ *  Both sides settle by the same word in the header, so they agree
+ *  even when the other side turns up late.
+ */
+static void xfl_shmagree(PIPECONN*pc)
+  { struct XFLSHMHDR *hdr;
+    struct timespec t0, t1, ts;
+    PIPECONN *px, *pw;
+    unsigned int *peer, mode, old;
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    while (1)
+      {
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        ms = (t1.tv_sec - t0.tv_sec) * 1000
+           + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+
+        pw = NULL; peer = NULL;
+        for (px = pc; px != NULL; px = px->next)
+          { if ((px->flag & XFL_F_SHMEM) == 0) continue;
+            hdr = ((struct XFLSHM*)px->buff)->hdr;
+            peer = (px->flag & XFL_F_INPUT) ? &hdr->pattach : &hdr->cattach;
+
+            mode = __atomic_load_n(&hdr->mode,__ATOMIC_ACQUIRE);
+            if (mode == XFL_SHM_UNSET)
+              { if (__atomic_load_n(peer,__ATOMIC_ACQUIRE) != 0)
+                    mode = XFL_SHM_RING; else
+                if (ms >= XFL_SHM_AGREEMS || xfl_shmpeer(px) < 0)
+                    mode = XFL_SHM_PIPE; else
+                if (pw == NULL) pw = px;
+                /* whoever gets here first decides for both sides     */
+                old = XFL_SHM_UNSET;
+                if (mode != XFL_SHM_UNSET &&
+                   !__atomic_compare_exchange_n(&hdr->mode,&old,mode,0,
+                                    __ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST))
+                    mode = old; }
+
+            if (mode == XFL_SHM_PIPE) xfl_shmdrop(px); }
+        if (pw == NULL) return;
+
+        /* nap until the slowest of them says it is there (or a while) */
+        hdr = ((struct XFLSHM*)pw->buff)->hdr;
+        peer = (pw->flag & XFL_F_INPUT) ? &hdr->pattach : &hdr->cattach;
+        ts.tv_sec = 0; ts.tv_nsec = 10000000;
+        syscall(SYS_futex,peer,FUTEX_WAIT,0,&ts,NULL,0);
+      }
+  }
+
+#endif
+
+#ifdef XFL_URING
+
+/* -------------------------------------------------------------- URING
+ *  Optional io_uring backend for the pipe protocol: a write and the
+ *  read which must follow it go to the kernel as two linked entries
+ *  and are reaped together, one system call instead of two.
+ *  One small ring per thread, set up on first use and given back when
+ *  the stage (or the thread) ends. Any trouble and we go back to plain
+ *  read() and write() for good.
+ */
+#define  XFL_URING_DEPTH    4          /* submission entries in the ring */
+#define  XFL_URING_SMALL    4096  /* biggest write we hand to the ring */
+
+struct XFLURING {
+    int fd;          /* ring descriptor, -1 not yet set up, -2 not used */
+    unsigned int *sqtail, *sqmask, *sqarray;
+    unsigned int *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    char *sq, *cq;                      /* the mappings, to unmap them */
+    size_t sqlen, cqlen, sqeslen;
+               };
+static XFL_TLS struct XFLURING xfl_uring = { -1 };
+
+/* ----------------------------------------------------------- URINGFREE
+ *  Unmap and close this thread's ring, if it has one.
+ */
+static void xfl_uringfree()
+  { if (xfl_uring.fd < 0) return;
+    munmap(xfl_uring.sqes,xfl_uring.sqeslen);
+    if (xfl_uring.cq != xfl_uring.sq) munmap(xfl_uring.cq,xfl_uring.cqlen);
+    munmap(xfl_uring.sq,xfl_uring.sqlen);
+    close(xfl_uring.fd);
+    xfl_uring.fd = -1;
+  }
+
+#ifdef XFL_THREADS
+/* a thread which is not a stage of its own, such as those of the     */
+/* PARALLEL stage, gives back its ring when it ends                   */
+static pthread_key_t xfl_uringkey;
+static pthread_once_t xfl_uringonce = PTHREAD_ONCE_INIT;
+static void xfl_uringgone(void*p) { xfl_uringfree(); }
+static void xfl_uringkeep() { pthread_key_create(&xfl_uringkey,xfl_uringgone); }
+#endif
+
+/* ---------------------------------------------------------- URINGSETUP
+ *  Returns zero when the ring is ready to use, negative if it is not.
+ *  The backend is only used when PIPEOPT_URING=1 (or YES) is set:
+ *  a pipe read which has to wait costs io_uring more than read() does.
+ */
+static int xfl_uringsetup()
+  { struct io_uring_params pp;
+    size_t sqlen, cqlen;
+    char *sq, *cq, *p;
+    int fd;
+
+    if (xfl_uring.fd != -1) return (xfl_uring.fd < 0) ? -1 : 0;
+    xfl_uring.fd = -2;              /* until we know better: don't ask */
+
+    p = getenv("PIPEOPT_URING");
+    if (p == NULL || (*p != '1' && *p != 'y' && *p != 'Y')) return -1;
+
+    memset(&pp,0x00,sizeof(pp));
+    fd = syscall(SYS_io_uring_setup,XFL_URING_DEPTH,&pp);
+    if (fd < 0) return -1;
+
+    /* map the submission and completion rings, which newer kernels   */
+    /* put in a single mapping, and then the submission entries       */
+    sqlen = pp.sq_off.array + pp.sq_entries * sizeof(unsigned int);
+    cqlen = pp.cq_off.cqes + pp.cq_entries * sizeof(struct io_uring_cqe);
+    if (pp.features & IORING_FEAT_SINGLE_MMAP)
+      { if (cqlen > sqlen) sqlen = cqlen; cqlen = sqlen; }
+    sq = mmap(NULL,sqlen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+                                                fd,IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) { close(fd); return -1; }
+    if (pp.features & IORING_FEAT_SINGLE_MMAP) cq = sq; else
+      { cq = mmap(NULL,cqlen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+                                                fd,IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { munmap(sq,sqlen); close(fd); return -1; } }
+    xfl_uring.sqeslen = pp.sq_entries * sizeof(struct io_uring_sqe);
+    xfl_uring.sqes = mmap(NULL,xfl_uring.sqeslen,
+                PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+    if (xfl_uring.sqes == MAP_FAILED)
+      { if (cq != sq) munmap(cq,cqlen); munmap(sq,sqlen);
+        close(fd); return -1; }
+    xfl_uring.sq = sq; xfl_uring.sqlen = sqlen;
+    xfl_uring.cq = cq; xfl_uring.cqlen = cqlen;
+
+    xfl_uring.sqtail  = (unsigned int*) (sq + pp.sq_off.tail);
+    xfl_uring.sqmask  = (unsigned int*) (sq + pp.sq_off.ring_mask);
+    xfl_uring.sqarray = (unsigned int*) (sq + pp.sq_off.array);
+    xfl_uring.cqhead  = (unsigned int*) (cq + pp.cq_off.head);
+    xfl_uring.cqtail  = (unsigned int*) (cq + pp.cq_off.tail);
+    xfl_uring.cqmask  = (unsigned int*) (cq + pp.cq_off.ring_mask);
+    xfl_uring.cqes = (struct io_uring_cqe*) (cq + pp.cq_off.cqes);
+
+    xfl_uring.fd = fd;
+#ifdef XFL_THREADS
+    pthread_once(&xfl_uringonce,xfl_uringkeep);
+    pthread_setspecific(xfl_uringkey,&xfl_uring);
+#endif
+    return 0;
+  }
+
+/* -------------------------------------------------------------- URINGRW
+ *  Write the pieces in "wv" to "wfd" and then read into "rv" from "rfd",
+ *  the read linked to the write so it starts only once the write is done.
+ *  Returns what writev() would, with what readv() would in *rrc.
+ *  A read which did not happen (the write fell short) gives -ECANCELED.
+ *  Returns -2 if the ring failed before doing anything; use plain I/O.
+ */
+static int xfl_uringrw(int wfd,const struct iovec*wv,int wcnt,
+                        int rfd,const struct iovec*rv,int rcnt,int*rrc)
+  { struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    unsigned int tail, head, mask, k;
+    int rc, res[2], got;
+
+    mask = *xfl_uring.sqmask;
+    tail = *xfl_uring.sqtail;
+    for (k = 0; k < 2; k++)
+      { sqe = &xfl_uring.sqes[(tail + k) & mask];
+        memset(sqe,0x00,sizeof(*sqe));
+        sqe->opcode = (k == 0) ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = (k == 0) ? wfd : rfd;
+        sqe->addr = (unsigned long) ((k == 0) ? wv : rv);
+        sqe->len = (k == 0) ? wcnt : rcnt;
+        sqe->off = (__u64) -1;               /* pipes have no offset */
+        sqe->flags = (k == 0) ? IOSQE_IO_LINK : 0;
+        sqe->user_data = k;
+        xfl_uring.sqarray[(tail + k) & mask] = (tail + k) & mask; }
+    __atomic_store_n(xfl_uring.sqtail,tail + 2,__ATOMIC_RELEASE);
+
+    /* submit both and wait for both to complete                      */
+    res[0] = res[1] = -ECANCELED;
+    rc = syscall(SYS_io_uring_enter,xfl_uring.fd,2,2,
+                                        IORING_ENTER_GETEVENTS,NULL,0);
+    got = 0;
+    while (1)
+      {
+        head = *xfl_uring.cqhead;
+        while (head != __atomic_load_n(xfl_uring.cqtail,__ATOMIC_ACQUIRE))
+          { cqe = &xfl_uring.cqes[head & *xfl_uring.cqmask];
+            if (cqe->user_data < 2) res[cqe->user_data] = cqe->res;
+            head++; got++; }
+        __atomic_store_n(xfl_uring.cqhead,head,__ATOMIC_RELEASE);
+        if (got >= 2) break;
+        if (rc < 0 && errno != EINTR) break;
+        rc = syscall(SYS_io_uring_enter,xfl_uring.fd,0,2 - got,
+                                        IORING_ENTER_GETEVENTS,NULL,0);
+      }
+
+    if (rc < 0 && got < 2)
+      { /* the ring itself failed us, so never use it again           */
+        xfl_uringfree(); xfl_uring.fd = -2;
+        if (got == 0) return -2; }
+
+    *rrc = (res[1] < 0) ? -1 : res[1];
+    if (res[1] < 0 && res[1] != -ECANCELED) errno = 0 - res[1];
+    if (res[1] == -ECANCELED) *rrc = -ECANCELED;
+    if (res[0] < 0) { errno = 0 - res[0]; return -1; }
+    return res[0];
+  }
+
+#endif
+
 #ifdef DELETE_THIS_PLEASE
 
 /* ----------------------------------------------------------- STAGEEXEC
@@ -238,117 +1215,717 @@ int xfl_stageexec(char*args,PIPECONN*pc[])
 
 #endif
 
-/* ---------------------------------------------------------- STAGESPAWN
- *       Calls: the stage indicated in argv[0]
- *   Called by: launcher
+/* ------------------------------------------------------------------ */
+/* Finding stages: each verb is looked up along PIPEPATH once and the */
+/* answer is kept for as long as this process lives, filed under the  */
+/* verb, the PIPEPATH, and whether the multicall program may be used, */
+/* since any of them can change the answer. Now and then the          */
+/* directories are looked at, and if one has changed (a stage added   */
+/* or removed) or PIPEPATH has, the answers are tossed.               */
+
+#define XFL_FIND_HASH   64       /* buckets, more than most pipelines */
+#define XFL_FIND_CHECK  1         /* seconds between directory checks */
+
+static struct XFLFOUND {
+    struct XFLFOUND *next;                /* next in this hash bucket */
+    unsigned int hash;
+    char *verb;                              /* as given on the stage */
+    char *pipepath;                          /* what it was looked on */
+    int multi;                 /* the multicall program was allowed */
+    char *path;                     /* where the executable was found */
+                       } *xfl_found[XFL_FIND_HASH];
+
+static char *xfl_findpath = NULL;        /* PIPEPATH the cache is for */
+static int xfl_finddirs = 0;               /* directories in PIPEPATH */
+static struct timespec *xfl_findtime = NULL; /* mtime of each of them */
+static time_t xfl_findlast = 0;    /* when directories were looked at */
+
+/* ------------------------------------------------------------ FINDHASH
+ *  FNV-1a over the whole key, which is plenty for a few dozen verbs
  */
-int xfl_stagespawn(int argc,char*argv[],PIPECONN*pc[],PIPESTAGE*sx)
-  /* argc - count of arguments much like Unix/POSIX main()            */
-  /* argv - argument array much like Unix/POSIX main()                */
-  /* pc   - pipe connector(s) this stage will use (input and output)  */
-  { static char _eyecatcher[] = "xfl_stagespawn()";
-    int rc, i, ii, io;
-    char *p, *q, envbuf[8192], tmpbuf[256], pipepath[8192], *verb;
-    PIPECONN *px;
+static unsigned int xfl_findhash(char*verb,char*pipepath,int multi)
+  { unsigned int h;
+    h = 2166136261u;
+    while (*verb != 0x00) { h ^= (unsigned char) *verb++; h *= 16777619u; }
+    h *= 16777619u;                  /* a zero byte between the parts */
+    while (*pipepath != 0x00)
+      { h ^= (unsigned char) *pipepath++; h *= 16777619u; }
+    h ^= (multi ? '1' : '0'); h *= 16777619u;
+    return h; }
+
+/* ----------------------------------------------------------- FINDFLUSH
+ *  forget everything we found, as when a directory has changed
+ */
+static void xfl_findflush()
+  { struct XFLFOUND *ff, *fn;
+    int i;
+    for (i = 0; i < XFL_FIND_HASH; i++)
+      { for (ff = xfl_found[i]; ff != NULL; ff = fn)
+          { fn = ff->next;
+            free(ff->verb); free(ff->pipepath); free(ff->path); free(ff); }
+        xfl_found[i] = NULL; }
+  }
+
+/* ----------------------------------------------------------- FINDCHECK
+ *  Be sure the cache is for this PIPEPATH and that none of its
+ *  directories has changed. Looking is limited to once in a while.
+ */
+static void xfl_findcheck(char*pipepath)
+  { struct timespec now, *tv;
     struct stat sb;
+    char dir[8192], *p, *q;
+    int i, n, changed;
+
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    changed = 0;
+
+    if (xfl_findpath == NULL || strcmp(xfl_findpath,pipepath) != 0)
+      { free(xfl_findpath); xfl_findpath = strdup(pipepath);
+        for (n = 1, p = pipepath; *p != 0x00; p++) if (*p == ':') n++;
+        tv = realloc(xfl_findtime,n * sizeof(struct timespec));
+        if (tv == NULL || xfl_findpath == NULL)
+          { xfl_findflush(); return; }       /* just look every time */
+        memset(tv,0x00,n * sizeof(struct timespec));
+        xfl_findtime = tv; xfl_finddirs = n;
+        changed = 1; }
+    else if (now.tv_sec - xfl_findlast < XFL_FIND_CHECK) return;
+    xfl_findlast = now.tv_sec;
+
+    /* an added or removed stage changes its directory's mtime         */
+    p = xfl_findpath;
+    for (i = 0; i < xfl_finddirs; i++)
+      { for (q = dir; *p != 0x00 && *p != ':' && q < &dir[sizeof(dir)-1]; )
+            *q++ = *p++;
+        *q = 0x00; if (*p == ':') p++;
+        if (stat(dir,&sb) != 0) memset(&sb,0x00,sizeof(sb));
+        if (sb.st_mtim.tv_sec  != xfl_findtime[i].tv_sec ||
+            sb.st_mtim.tv_nsec != xfl_findtime[i].tv_nsec)
+          { xfl_findtime[i] = sb.st_mtim; changed = 1; } }
+
+    if (changed) xfl_findflush();
+  }
 
-    p = envbuf;
+/* ------------------------------------------------------------------ */
+/* Stages which come with Ductwork, by the name each is known by, the */
+/* shortest abbreviation allowed, and the stage it is really (if not  */
+/* itself). The stages themselves are listed in xflstages.h, which    */
+/* the multicall stage program, stages/xflstage.c, also builds from.  */
+
+static struct XFLVERB {
+    char *verb;
+    int min;                   /* shortest abbreviation, else length */
+    char *stage;                          /* NULL if it is the verb */
+                      } xfl_verbs[] = {
+#define XFL_STAGE(verb,min) { #verb, min, NULL },
+#include "xflstages.h"
+    { "elastic",    7, "buffer" },      /* buffer for the time being */
+    { "<",          1, "filer" },            /* magical file syntax */
+    { ">",          1, "filew" },
+    { ">>",         2, "filea" },
+    { NULL,         0, NULL } };
+
+#define XFL_MULTICALL "xflstage"   /* the one program for all of those */
+
+/* ----------------------------------------------------------- STAGEVERB
+ *  Resolve abbreviations and aliases of the stages which come with
+ *  Ductwork. Upper or lower case, as on CMS.
+ *  Returns: the full name of the stage, or NULL if it is not one of them
+ */
+char *xfl_stageverb(char*verb)
+  { int i, l;
+    if (verb == NULL) return NULL;
+    l = strlen(verb);
+    for (i = 0; xfl_verbs[i].verb != NULL; i++)
+      if (l >= xfl_verbs[i].min && l <= strlen(xfl_verbs[i].verb)
+        && strncasecmp(verb,xfl_verbs[i].verb,l) == 0)
+        return (xfl_verbs[i].stage != NULL) ? xfl_verbs[i].stage
+                                            : xfl_verbs[i].verb;
+    return NULL;
+  }
+
+/* ----------------------------------------------------------- STAGEFIND
+ *  Resolve a stage verb to the executable which runs it by searching
+ *  PIPEPATH (else $PREFIX/libexec/xfl). This is done by the launcher
+ *  before anything is forked, so a missing stage can be reported
+ *  before any of the pipeline has started.
+ *  Returns: zero with the full path copied to "path", or negative
+ */
+int xfl_stagefind(char*verb,char*path,int pathlen)
+  { static char _eyecatcher[] = "xfl_stagefind()";
+    char *p, *q, *multi, *pipepath, tmpbuf[8192];
+    struct XFLFOUND *ff;
+    struct stat sb;
+    unsigned int h;
+    int rc, m;
+
+    if (verb == NULL || path == NULL)
+      { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* a stage which comes with Ductwork may be abbreviated, and it  */
+    /* is run by the multicall program where that has been installed */
+    multi = xfl_stageverb(verb);
+    if (multi != NULL) verb = multi;
+    p = getenv("PIPEOPT_MULTICALL");
+    if (p != NULL && (*p == '0' || *p == 'n' || *p == 'N')) multi = NULL;
+
+    m = (multi != NULL);
+
+    p = getenv("PIPEPATH"); if (p == NULL) p = "";
+    if (*p == 0x00) p = PREFIX "/libexec/xfl";
+    xfl_findcheck(p);
+    pipepath = p;
+
+    /* maybe we already know where this one lives                     */
+    h = xfl_findhash(verb,pipepath,m);
+    for (ff = xfl_found[h % XFL_FIND_HASH]; ff != NULL; ff = ff->next)
+      if (ff->hash == h && ff->multi == m && strcmp(ff->verb,verb) == 0
+                                 && strcmp(ff->pipepath,pipepath) == 0)
+        { if (strlen(ff->path) >= pathlen) break;
+          strcpy(path,ff->path); return 0; }
+
+    /* else scan PIPEPATH for the stage of interest                   */
+    rc = -1;
+    while (*p != 0x00)
+      { q = p + strcspn(p,":");            /* end of this directory */
+        if (multi != NULL)
+          { snprintf(tmpbuf,sizeof(tmpbuf),"%.*s/%s",
+                                      (int)(q - p),p,XFL_MULTICALL);
+            if (stat(tmpbuf,&sb) == 0 && S_ISREG(sb.st_mode))
+              { rc = 0; break; } }        /* found it, all of them! */
+        snprintf(tmpbuf,sizeof(tmpbuf),"%.*s/%s",(int)(q - p),p,verb);
+        if (stat(tmpbuf,&sb) == 0 && S_ISREG(sb.st_mode))
+          { rc = 0; break; }                          /* found it! */
+        p = (*q == ':') ? q + 1 : q; }
+    if (rc < 0 || strlen(tmpbuf) >= pathlen) return -1;
+    strcpy(path,tmpbuf);
+
+    /* and remember it for next time                                  */
+    ff = malloc(sizeof(struct XFLFOUND));
+    if (ff != NULL)
+      { ff->hash = h;
+        ff->verb = strdup(verb);
+        ff->pipepath = strdup(pipepath);
+        ff->multi = m;
+        ff->path = strdup(tmpbuf);
+        if (ff->verb == NULL || ff->pipepath == NULL || ff->path == NULL)
+          { free(ff->verb); free(ff->pipepath); free(ff->path); free(ff); }
+        else
+          { ff->next = xfl_found[h % XFL_FIND_HASH];
+            xfl_found[h % XFL_FIND_HASH] = ff; } }
+
+    return 0;
+  }
+
+/* ---------------------------------------------------------- STAGECONN
+ *  Make the "PIPECONN=..." string which tells a stage its connectors,
+ *  each marked KEEP until the stage has been started.
+ *  Returns: the string (to be freed by the caller) or NULL
+ */
+static char *xfl_stageconnstr(PIPECONN*pc[])
+  { int i, ii, io, n;
+    char *p, *q, *envbuf, tmpbuf[256];
+
+    /* room for "PIPECONN=" and one token per connector (no limit)    */
+    for (n = 0; pc[n] != NULL; n++);
+    envbuf = malloc(sizeof("PIPECONN=") + n * sizeof(tmpbuf));
+    if (envbuf == NULL)
+      { char *msgv[2], em[16]; int en;
+        en = errno;    /* hold onto the error value in case it resets */
+        perror("xfl_stageconnstr(): malloc()");    /* standard report */
+        sprintf(em,"%d",en); msgv[1] = em;       /* integer to string */
+        xfl_error(26,2,msgv,"LIB");        /* provide specific report */
+        return NULL; }
+
+    strcpy(envbuf,"PIPECONN=");
+    p = envbuf + sizeof("PIPECONN=") - 1;
     /* process the supplied array of connectors */
     i = ii = io = 0; while (pc[i] != NULL)
       {
         if (pc[i]->flag & XFL_F_INPUT)
-        sprintf(tmpbuf,"*.INPUT.%d:%d,%d",ii++,pc[i]->fdf,pc[i]->fdr);
+        sprintf(tmpbuf,"*.INPUT.%d",ii++);
       else
         if (pc[i]->flag & XFL_F_OUTPUT)
-        sprintf(tmpbuf,"*.OUTPUT.%d:%d,%d",io++,pc[i]->fdf,pc[i]->fdr);
+        sprintf(tmpbuf,"*.OUTPUT.%d",io++);
       else
 // 0100    E Direction "&1" not input or output
 { printf("fail\n");
+        free(envbuf);
         xfl_errno = XFL_E_DIRECTION;
- return -1; }
+ return NULL; }
+
+        /* a shared memory ring rides along after the stream number,  */
+        /* where a stage from before the ring skips over it           */
+        q = tmpbuf; while (*q != 0x00) q++;
+        if (pc[i]->fdm >= 0) { sprintf(q,",%d",pc[i]->fdm);
+                               while (*q != 0x00) q++; }
+        sprintf(q,":%d,%d",pc[i]->fdf,pc[i]->fdr);
 
         /* copy this token into the environment variable buffer       */
         q = tmpbuf;
-        while (*q != 0x00) *p++ = *q++; *p++ = ' ';
+        while (*q != 0x00) *p++ = *q++;
+        *p++ = ' ';
 
         pc[i]->flag |= XFL_F_KEEP;
         i++;
       }
     *p = 0x00;                                /* terminate the string */
 
-// FIXME: we should do the PIPEPATH scanning before we fork()
+    return envbuf;
+  }
+
+/* ------------------------------------------------------------ FORKEXEC
+ *  Start a stage the traditional way. The child has a copy of all of
+ *  the launcher, but the connectors are close-on-exec, so all it must
+ *  do is let its own through and then run the stage.
+ *  Returns: PID of the child or negative
+ */
+static pid_t xfl_forkexec(char*path,char*argv[],PIPECONN*pc[],char*pipeconn)
+  { pid_t pid;
+    int i;
 
     /* fork() is expensive but the most common and reliable way here  */
-    rc = fork();
-    if (rc < 0) return errno;       /* negative return code: an error */
-    if (rc > 0) {             /* positive return code is PID of child */
-                          /* process the supplied array of connectors */
-                  i = 0; while (pc[i] != NULL) { pc[i]->cpid = rc;
-                                                 pc[i]->flag -= XFL_F_KEEP;
-//                                     xfl_sever(pc[i]);
-                                                 sx->cpid = rc;
-                                                 i++;
- }
-//                i has the count of connectors, for what that's worth
-                  return 0; }
-    /* and finally, fork() returning zero means we are the child      */
+    pid = fork();
+    if (pid < 0) { perror("xfl_stagespawn(): fork()"); return -1; }
+    if (pid > 0) return pid;        /* positive return is PID of child */
 
 /* -- at this point we are the child process ------------------------ */
 
-//printf("xfl_stagespawn(%d,%s %s)\n",argc,argv[0],argv[1]);
-
     /* prepare to pass connector info to the stage when it runs       */
-    setenv("PIPECONN",envbuf,1);
+    putenv(pipeconn);
 
-    px = xfl_pipeconn;
-    while (px != NULL)
-      {          /* close the connectors which the child will not use */
-        if (px->flag & XFL_F_KEEP); else
-// if not previously closed ...
-          {
+    /* and keep across the exec just the connectors this stage uses   */
+    for (i = 0; pc[i] != NULL; i++)
+      { fcntl(pc[i]->fdf,F_SETFD,0);
+        if (pc[i]->fdr != pc[i]->fdf) fcntl(pc[i]->fdr,F_SETFD,0);
+        if (pc[i]->fdm >= 0) fcntl(pc[i]->fdm,F_SETFD,0); }
+
+    execv(path,argv);
+
+    /* still here? then the exec failed and we must not carry on as   */
+    /* a second copy of the launcher                                  */
+    perror("xfl_stagespawn(): execv()");           /* standard report */
+    _exit(127);
+  }
+
+#ifdef XFL_SPAWN
+/* PIPEOPT_SPAWN=FORK goes back to fork(), for comparison; -1 not read */
+static int xfl_spawnfork = -1;
+
+/* ------------------------------------------------------------- SPAWNFD
+ *  Copy "fd" to a spare descriptor and have the child dup2() it back.
+ *  Returns: zero, or an error number as posix_spawn() does
+ */
+static int xfl_spawnfd(posix_spawn_file_actions_t*fa,int fd,int*spare,int*k)
+  { int sd;
+    sd = fcntl(fd,F_DUPFD_CLOEXEC,0);
+    if (sd < 0) return errno;
+    spare[(*k)++] = sd;
+    return posix_spawn_file_actions_adddup2(fa,sd,fd);
+  }
+
+/* --------------------------------------------------------------- SPAWN
+ *  Start a stage with posix_spawn(), which on Linux borrows the
+ *  launcher's memory until the exec (CLONE_VM|CLONE_VFORK) instead of
+ *  copying its page tables. Each connector of the stage is copied to a
+ *  spare descriptor, and the file actions dup2() it back onto its own
+ *  number in the child, which leaves that one open across the exec.
+ *  (dup2() of a descriptor onto itself would do, but only some systems
+ *  clear close-on-exec that way: not glibc before 2.29, nor macOS.)
+ *  Returns: PID of the child or negative
+ */
+static pid_t xfl_spawn(char*path,char*argv[],PIPECONN*pc[],char*pipeconn)
+  { posix_spawn_file_actions_t fa;
+    char **envp, **e;
+    pid_t pid;
+    int i, k, n, rc, *spare;
+
+    /* the stage gets our environment but its own PIPECONN            */
+    for (i = 0; environ[i] != NULL; i++);
+    envp = malloc((i + 2) * sizeof(char*));
+    if (envp == NULL) { perror("xfl_stagespawn(): malloc()"); return -1; }
+    for (i = 0, e = environ; *e != NULL; e++)
+      if (strncmp(*e,"PIPECONN=",9) != 0) envp[i++] = *e;
+    envp[i++] = pipeconn;
+    envp[i] = NULL;
+
+    /* room for three spares per connector, themselves close-on-exec  */
+    for (n = 0; pc[n] != NULL; n++);
+    spare = malloc((3 * n + 1) * sizeof(int));
+    if (spare == NULL)
+      { perror("xfl_stagespawn(): malloc()"); free(envp); return -1; }
+
+    posix_spawn_file_actions_init(&fa);
+    rc = 0;
+    for (i = 0, k = 0; pc[i] != NULL && rc == 0; i++)
+      { rc = xfl_spawnfd(&fa,pc[i]->fdf,spare,&k);
+        if (rc == 0 && pc[i]->fdr != pc[i]->fdf)
+            rc = xfl_spawnfd(&fa,pc[i]->fdr,spare,&k);
+        if (rc == 0 && pc[i]->fdm >= 0)
+            rc = xfl_spawnfd(&fa,pc[i]->fdm,spare,&k); }
+
+    if (rc == 0) rc = posix_spawn(&pid,path,&fa,NULL,argv,envp);
+    posix_spawn_file_actions_destroy(&fa);
+    while (k > 0) close(spare[--k]);
+    free(spare);
+    free(envp);
+
+    if (rc != 0)
+      { errno = rc;
+        perror("xfl_stagespawn(): posix_spawn()"); /* standard report */
+        return -1; }
+    return pid;
+  }
+#endif
+
+#ifdef XFL_THREADS
+/* ------------------------------------------------------------------ */
+/* Stages built as modules (verb.so beside the executable, with main()*/
+/* renamed xfl_stagemain) are loaded once and kept, whether they then */
+/* run as threads or in processes forked from a warm launcher.        */
+
+static struct XFLMODULE {
+    struct XFLMODULE *next;
+    char *path;                           /* of the executable, not .so */
+    int (*stagemain)(int,char*[]);          /* NULL if there is none */
+                         } *xfl_modules = NULL;
+
+/* ---------------------------------------------------------- STAGEMODULE
+ *  Returns: the entry point of the module for the stage at "path",
+ *  loading it the first time, or NULL if the stage has no module
+ */
+static int (*xfl_stagemodule(char*path))(int,char*[])
+  { struct XFLMODULE *xm;
+    char sopath[8192];
+    struct stat sb;
+    void *dl;
+
+    for (xm = xfl_modules; xm != NULL; xm = xm->next)
+      if (strcmp(xm->path,path) == 0) return xm->stagemain;
+
+    xm = malloc(sizeof(struct XFLMODULE));
+    if (xm == NULL) return NULL;
+    xm->path = strdup(path);
+    if (xm->path == NULL) { free(xm); return NULL; }
+    xm->stagemain = NULL;
+
+    /* the stage finds the library in the launcher (linked -rdynamic) */
+    snprintf(sopath,sizeof(sopath),"%s.so",path);
+    if (stat(sopath,&sb) == 0)                  /* built as a module? */
+      { dl = dlopen(sopath,RTLD_NOW|RTLD_LOCAL);
+        if (dl == NULL) fprintf(stderr,"xfl_stagemodule(): %s\n",dlerror());
+        else xm->stagemain = (int(*)(int,char*[])) dlsym(dl,"xfl_stagemain"); }
+
+    /* remember misses too, so as not to look again                   */
+    xm->next = xfl_modules;
+    xfl_modules = xm;
+    return xm->stagemain;
+  }
+
+/* PIPEOPT_SPAWN=WARM forks stages which have a module without exec   */
+static int xfl_spawnwarm = -1;
+
+/* ------------------------------------------------------------ FORKWARM
+ *  Start a stage by forking the launcher and calling the stage's main()
+ *  from its module, already loaded, so there is no exec, no loading,
+ *  and no relocation. What exec would have done for close-on-exec, the
+ *  child does by hand: it closes every connector which is not its own.
+ *  Returns: PID of the child or negative
+ */
+static pid_t xfl_forkwarm(int(*stagemain)(int,char*[]),char*argv[],
+                                            PIPECONN*pc[],char*pipeconn)
+  { PIPECONN *px;
+    pid_t pid;
+    int i;
+
+    fflush(NULL);        /* else what is buffered comes out twice */
+    pid = fork();
+    if (pid < 0) perror("xfl_stagespawn(): fork()");
+    if (pid != 0) return pid;
+
+    if (xfl_daemonfd >= 0) close(xfl_daemonfd);
+    for (px = xfl_pipeconn; px != NULL; px = px->next)
+      { i = 0;
+        while (pc[i] != NULL && pc[i] != px) i++;
+        if (pc[i] != NULL) continue;
         close(px->fdf);
-        close(px->fdr);
-// or maybe sever(px) instead?
-          }
-// step through connectors listed closing all *not* listed
-        px = px->next;
-      }
+        if (px->fdr != px->fdf) close(px->fdr);
+        if (px->fdm >= 0) close(px->fdm); }
 
-if (argc < 2) argv[1] = NULL;
+    xfl_stageconn = pipeconn + sizeof("PIPECONN=") - 1;
+    exit(stagemain(argv[1] != NULL ? 2 : 1,argv));
+  }
 
-    /* scan PIPEPATH for the stage of interest ($PREFIX/libexec/xfl)  */
-    p = getenv("PIPEPATH"); if (p == NULL) p = "";
-    if (*p == 0x00) p = PREFIX "/libexec/xfl";
-//  if (*p == 0x00) p = "stages"; // FIXME: remember to define PIPEPATH
-    strncpy(pipepath,p,sizeof(pipepath)-1);
-    p = q = pipepath;
-    while (1)
-      {
-        /* find a searchable directory in the PIPEPATH string         */
-        while (*p != 0x00 && *p != ':') p++;
-        if (*p != 0x00) *p++ = 0x00;
+/* ------------------------------------------------------------- PRELOAD
+ *  Read the message catalog and load the modules of the supplied
+ *  stages now, as a long-lived launcher does before forking copies
+ *  of itself, so that each copy starts with them already in memory.
+ *  Returns: the number of stage modules loaded
+ */
+int xfl_preload()
+  { static char _eyecatcher[] = "xfl_preload()";
+    char path[8192];
+    int i, n;
 
-        verb = argv[0];
+    if (!xfl_msgsopen) xfl_msgsopen = (xmopen("xfl",0,&xflmsgs) == 0);
 
-        /* magical file syntax fixup */
-        if (strcmp(verb,"<") == 0) verb = "filer";
-        if (strcmp(verb,">") == 0) verb = "filew";
-        if (strcmp(verb,">>") == 0) verb = "filea";
-        /* magical file syntax fixup */
+    n = 0;
+    for (i = 0; xfl_verbs[i].verb != NULL; i++)
+      { if (xfl_verbs[i].stage != NULL) continue;     /* just an alias */
+        if (xfl_stagefind(xfl_verbs[i].verb,path,sizeof(path)) < 0)
+            continue;
+        if (xfl_stagemodule(path) != NULL) n++; }
 
-        /* abbreviation logic should go near here */
+    return n;
+  }
+#else
+int xfl_preload()
+  { if (!xfl_msgsopen) xfl_msgsopen = (xmopen("xfl",0,&xflmsgs) == 0);
+    return 0; }
+#endif
 
-        snprintf(tmpbuf,sizeof(tmpbuf),"%s/%s",q,verb);   /* looking for arg0 */
-        rc = stat(tmpbuf,&sb);
-        if (rc == 0) break;       /* found it! break out with success */
-        if (*p == 0x00) break;  /* if end of string break out failing */
-        q = p;         /* otherwise try again with next dir in search */
-      }
-//  if (rc == 0) printf("xfl_stagespawn(): found '%s'\n",tmpbuf);
-//          else printf("xfl_stagespawn(): failed to find '%s'\n",argv[0]);
-    if (rc == 0) execv(tmpbuf,argv);
-// FIXME: if executable not found we should return to the caller
-// FIXME: and that means this needs to be processed before the fork()
+#ifdef XFL_AFFINITY
+/* ------------------------------------------------------------------ */
+/* PIPEOPT_AFFINITY places stages on processors. "compact" puts each */
+/* stage next to the one before it: on a sibling hyperthread, else on */
+/* the same package. "spread" gives each a core of its own, taking    */
+/* packages in turn. "label=cpus" pins the stage with that label to a */
+/* list such as 0-3,8. Items are separated by ';'. A stage which none */
+/* of them covers is left to the kernel. A new process or thread gets */
+/* the affinity of whoever started it, so the launcher takes on each  */
+/* stage's affinity just while starting it, whichever way it starts.  */
+
+/* policy: -1 not yet read, 0 none, 1 compact, 2 spread              */
+static int xfl_placepolicy = -1;
+static char *xfl_placelist = NULL;    /* copy of PIPEOPT_AFFINITY */
+static int *xfl_placecpu = NULL;     /* processors in policy order */
+static int xfl_placen = 0, xfl_placenext = 0;  /* how many, next one */
+static cpu_set_t xfl_placeheld;     /* the launcher's own affinity */
+
+/* ------------------------------------------------------------- CPUTOPO
+ *  Returns: a number from the processor's topology, else -1
+ */
+static int xfl_cputopo(int cpu,char*what)
+  { char fn[128];
+    FILE *fp;
+    int n;
+    snprintf(fn,sizeof(fn),
+        "/sys/devices/system/cpu/cpu%d/topology/%s",cpu,what);
+    fp = fopen(fn,"r");
+    if (fp == NULL) return -1;
+    if (fscanf(fp,"%d",&n) != 1) n = -1;
+    fclose(fp);
+    return n;
+  }
+
+struct XFLCPU { int cpu, pkg, core, rank; };
+
+static int xfl_cpucompact(const void*a,const void*b)
+  { const struct XFLCPU *x = a, *y = b;
+    if (x->pkg  != y->pkg)  return x->pkg  - y->pkg;
+    if (x->core != y->core) return x->core - y->core;
+    return x->rank - y->rank; }
+
+static int xfl_cpuspread(const void*a,const void*b)
+  { const struct XFLCPU *x = a, *y = b;
+    if (x->rank != y->rank) return x->rank - y->rank;
+    if (x->core != y->core) return x->core - y->core;
+    return x->pkg - y->pkg; }
+
+/* ------------------------------------------------------------- CPULIST
+ *  Parse a list of processors like "0-3,8" up to ';' or the end.
+ *  Returns: the number of processors in the set
+ */
+static int xfl_cpulist(char*p,cpu_set_t*set)
+  { int a, b;
+    CPU_ZERO(set);
+    while (*p >= '0' && *p <= '9')
+      { a = b = strtol(p,&p,10);
+        if (*p == '-') b = strtol(p+1,&p,10);
+        for ( ; a <= b && a < CPU_SETSIZE; a++) CPU_SET(a,set);
+        if (*p != ',') break;
+        p++; }
+    return CPU_COUNT(set);
+  }
+
+/* ---------------------------------------------------------- PLACESETUP
+ *  Read PIPEOPT_AFFINITY and put the processors we may use in order.
+ */
+static void xfl_placesetup()
+  { struct XFLCPU *cv;
+    char *p, *q, *msgv[2];
+    int i, j, k, n;
+
+    xfl_placepolicy = 0;
+    p = getenv("PIPEOPT_AFFINITY");
+    if (p == NULL || *p == 0x00) return;
+    xfl_placelist = strdup(p);
+    if (xfl_placelist == NULL) return;
+    if (sched_getaffinity(0,sizeof(xfl_placeheld),&xfl_placeheld) != 0)
+      { xfl_placelist = NULL; return; }
+
+    /* the policy word, if any; the rest are label=cpus items         */
+    for (p = xfl_placelist; *p != 0x00; p = (*q == ';') ? q + 1 : q)
+      { q = p + strcspn(p,";");
+        if (memchr(p,'=',q - p) != NULL) continue;
+        if (q - p == 7 && strncasecmp(p,"COMPACT",7) == 0)
+            xfl_placepolicy = 1; else
+        if (q - p == 6 && strncasecmp(p,"SPREAD",6) == 0)
+            xfl_placepolicy = 2; else
+        if (!(q - p == 4 && strncasecmp(p,"NONE",4) == 0))
+          { char c = *q; *q = 0x00;
+            msgv[1] = p;
+            xfl_error(14,2,msgv,"LIB");       /* Option &1 not valid */
+            *q = c; } }
+    if (xfl_placepolicy == 0) return;
+
+    n = CPU_COUNT(&xfl_placeheld);
+    cv = malloc(n * sizeof(struct XFLCPU));
+    xfl_placecpu = malloc(n * sizeof(int));
+    if (cv == NULL || xfl_placecpu == NULL)
+      { free(cv); free(xfl_placecpu); xfl_placecpu = NULL;
+        xfl_placepolicy = 0; return; }
+
+    /* rank is which hyperthread of its core this processor is        */
+    for (i = j = 0; i < CPU_SETSIZE && j < n; i++)
+      { if (!CPU_ISSET(i,&xfl_placeheld)) continue;
+        cv[j].cpu = i;
+        cv[j].pkg = xfl_cputopo(i,"physical_package_id");
+        cv[j].core = xfl_cputopo(i,"core_id");
+        cv[j].rank = 0;
+        for (k = 0; k < j; k++)
+          if (cv[k].pkg == cv[j].pkg && cv[k].core == cv[j].core)
+            cv[j].rank++;
+        j++; }
+    qsort(cv,n,sizeof(struct XFLCPU),
+        (xfl_placepolicy == 1) ? xfl_cpucompact : xfl_cpuspread);
+    for (i = 0; i < n; i++) xfl_placecpu[i] = cv[i].cpu;
+    xfl_placen = n;
+    free(cv);
+  }
+
+/* ---------------------------------------------------------- STAGEPLACE
+ *  Take on the affinity the stage should have, just before starting it.
+ *  Returns: 1 if it was changed (so call xfl_stageunplace() after the
+ *  stage has been started), else 0
+ */
+static int xfl_stageplace(PIPESTAGE*sx,char*verb)
+  { cpu_set_t set;
+    char *p, *q, *msgv[3], cpus[256];
+    int i, l, n;
+
+    if (xfl_placepolicy < 0) xfl_placesetup();
+    if (xfl_placelist == NULL) return 0;
+
+    /* a stage with a label may have processors of its own            */
+    n = 0;
+    if (sx != NULL && sx->label != NULL && *sx->label != 0x00)
+      { l = strlen(sx->label);
+        for (p = xfl_placelist; *p != 0x00; p = (*q == ';') ? q + 1 : q)
+          { q = p + strcspn(p,";");
+            if (strncmp(p,sx->label,l) == 0 && p[l] == '=')
+              { n = xfl_cpulist(&p[l+1],&set); break; } } }
+
+    /* else the next one in policy order                              */
+    if (n == 0 && xfl_placen > 0)
+      { CPU_ZERO(&set);
+        CPU_SET(xfl_placecpu[xfl_placenext++ % xfl_placen],&set);
+        n = 1; }
+    if (n == 0) return 0;
+
+    if (sched_setaffinity(0,sizeof(set),&set) != 0)
+      { perror("xfl_stageplace(): sched_setaffinity()"); return 0; }
+
+    /* 3102 I stage &1 placed on processors &2                        */
+    for (i = 0, p = cpus, *p = 0x00; i < CPU_SETSIZE; i++)
+      if (CPU_ISSET(i,&set) && p < &cpus[sizeof(cpus)-16])
+        p += sprintf(p,"%s%d",(p == cpus) ? "" : ",",i);
+    msgv[1] = verb; msgv[2] = cpus;
+    xfl_trace(3102,3,msgv,"LIB");
+
+    return 1;
+  }
+
+/* -------------------------------------------------------- STAGEUNPLACE
+ *  and back to the launcher's own affinity once the stage is started
+ */
+static void xfl_stageunplace()
+  { sched_setaffinity(0,sizeof(xfl_placeheld),&xfl_placeheld); }
+#else
+#define xfl_stageplace(sx,verb) 0
+#define xfl_stageunplace()
+#endif
+
+/* ---------------------------------------------------------- STAGESPAWN
+ *       Calls: the stage indicated in argv[0]
+ *   Called by: launcher
+ */
+int xfl_stagespawn(int argc,char*argv[],PIPECONN*pc[],PIPESTAGE*sx)
+  /* argc - count of arguments much like Unix/POSIX main()            */
+  /* argv - argument array much like Unix/POSIX main()                */
+  /* pc   - pipe connector(s) this stage will use (input and output)  */
+  { static char _eyecatcher[] = "xfl_stagespawn()";
+    int i;
+    char *p, *envbuf, path[8192];
+    int placed, started;
+    pid_t pid;
+
+    /* find the executable while still in the parent, if the launcher */
+    /* did not already do so, so that failure can be reported back    */
+    if (sx != NULL && sx->path != NULL)
+      { strncpy(path,sx->path,sizeof(path)-1); path[sizeof(path)-1] = 0x00; }
+    else if (xfl_stagefind(argv[0],path,sizeof(path)) < 0)
+      { char *msgv[2];
+        msgv[1] = argv[0];
+        xfl_error(27,2,msgv,"LIB");  /* 0027 E Entry point &1 not found */
+        return -1; }
+
+if (argc < 2) argv[1] = NULL;
+
+    envbuf = xfl_stageconnstr(pc);
+    if (envbuf == NULL) return -1;
+
+    /* every connector is made close-on-exec, so the new stage gets   */
+    /* exactly the ones listed and nothing has to be closed for it    */
+#ifdef XFL_SPAWN
+    if (xfl_spawnfork < 0)
+      { p = getenv("PIPEOPT_SPAWN");
+        xfl_spawnfork = (p != NULL && strcasecmp(p,"FORK") == 0); }
+#endif
+    placed = xfl_stageplace(sx,argv[0]);     /* new stage inherits it */
+
+    /* three ways to start it: warm (fork, and call its module),      */
+    /* posix_spawn(), or else fork() and exec()                       */
+    pid = -1; started = 0;
+#ifdef XFL_THREADS
+    if (xfl_spawnwarm < 0)
+      { p = getenv("PIPEOPT_SPAWN");
+        xfl_spawnwarm = (p != NULL && strcasecmp(p,"WARM") == 0); }
+    if (xfl_spawnwarm)
+      { int (*stagemain)(int,char*[]);
+        stagemain = xfl_stagemodule(path);
+        if (stagemain != NULL)
+          { pid = xfl_forkwarm(stagemain,argv,pc,envbuf);
+            started = (pid >= 0); } }
+#endif
+#ifdef XFL_SPAWN
+    if (!started && !xfl_spawnfork)
+      { pid = xfl_spawn(path,argv,pc,envbuf);
+        started = 1; }
+#endif
+    if (!started)
+      { pid = xfl_forkexec(path,argv,pc,envbuf);
+        started = 1; }
+    if (placed) xfl_stageunplace();
+    free(envbuf);
+    if (pid < 0) return -1;      /* negative return code: an error */
+
+    /* process the supplied array of connectors */
+    for (i = 0; pc[i] != NULL; i++)
+      { pc[i]->cpid = pid;
+        pc[i]->flag &= ~XFL_F_KEEP; }
+    if (sx != NULL) sx->cpid = pid;
+
+    return 0;
 
 #ifdef THIS_WAS_REPLACED
 
@@ -370,13 +1947,45 @@ if (argc < 2) argv[1] = NULL;
 int xfl_pipepair(PIPECONN*pp[])
   { static char _eyecatcher[] = "xfl_pipepair()";
     struct PIPECONN p0, *pi, *po;
-    int fdf[2], fdr[2];
+    int fdf[2], fdr[2], fdm, seqpkt;
+    char *p;
+
+    /* the user may ask for one socket per connection instead of pipes */
+    p = getenv("PIPEOPT_TRANSPORT");
+    seqpkt = (p != NULL && strcasecmp(p,"SOCKET") == 0 && !xfl_inring);
+
+    if (seqpkt)
+      { /* one AF_UNIX socket pair carries both data and control      */
+        if (socketpair(AF_UNIX,SOCK_SEQPACKET,0,fdf) < 0)
+          { char *msgv[2], em[16]; int en;
+            en = errno;    /* hold onto the error value in case it resets */
+            perror("xfl_pipepair(): socketpair()");  /* standard report */
+            sprintf(em,"%d",en); msgv[1] = em;   /* integer to string */
+            xfl_error(26,2,msgv,"LIB");    /* provide specific report */
+            return en; }
+        fdr[0] = fdf[1];              /* producer reads control here */
+        fdr[1] = fdf[0];              /* consumer writes control here */
+        fdm = -1; } else {
 
     /* we need *two* traditional POSIX/Unix pipes */
     pipe(fdf);                  /* forward for data */
     pipe(fdr);                  /* reverse for control */
     /* FIXME: need to check for errors after these calls */
 
+    /* and a shared memory ring if the platform can give us one       */
+#ifdef XFL_SHMEM
+    fdm = xfl_shmcreate();
+#else
+    fdm = -1;
+#endif
+                      }
+
+    /* no stage inherits a connector unless it is handed that one     */
+    fcntl(fdf[0],F_SETFD,FD_CLOEXEC); fcntl(fdf[1],F_SETFD,FD_CLOEXEC);
+    if (!seqpkt)
+      { fcntl(fdr[0],F_SETFD,FD_CLOEXEC); fcntl(fdr[1],F_SETFD,FD_CLOEXEC); }
+    if (fdm >= 0) fcntl(fdm,F_SETFD,FD_CLOEXEC);
+
     /* establish the side used for input */
     pi = malloc(sizeof(p0));    /* pipeline input */
     if (pi == NULL)
@@ -387,9 +1996,19 @@ int xfl_pipepair(PIPECONN*pp[])
         xfl_error(26,2,msgv,"LIB");        /* provide specific report */
         return en; }
 
+    memset(pi,0x00,sizeof(p0));
     pi->fdf /* read  */ = fdf[0]; /* data forward */
     pi->fdr /* write */ = fdr[1]; /* control back */
+    pi->fdm = fdm;
     pi->flag = XFL_F_INPUT;
+    if (seqpkt) pi->flag |= XFL_F_SEQPKT;
+
+#ifdef F_SETPIPE_SZ
+    /* the user may know that records will be big: size the pipe now  */
+    p = getenv("PIPEOPT_PIPESIZE");
+    if (!seqpkt && p != NULL && *p >= '0' && *p <= '9')
+        fcntl(fdf[1],F_SETPIPE_SZ,atoi(p));
+#endif
 
     /* establish the side used for output */
     po = malloc(sizeof(p0));    /* pipeline output */
@@ -403,9 +2022,13 @@ int xfl_pipepair(PIPECONN*pp[])
         return en; }
 
 
+    memset(po,0x00,sizeof(p0));
     po->fdf /* write */ = fdf[1]; /* data forward */
     po->fdr /* read  */ = fdr[0]; /* control back */
+    /* each side gets its own memfd so that either can be closed alone */
+    if (fdm >= 0) po->fdm = fcntl(fdm,F_DUPFD_CLOEXEC,0); else po->fdm = -1;
     po->flag = XFL_F_OUTPUT;
+    if (seqpkt) po->flag |= XFL_F_SEQPKT;
 
     /* cross-link these to each other and insert them into the chain  */
     pi->next = po;                   /* input links forward to output */
@@ -478,7 +2101,11 @@ int xfl_getpipepart(PIPESTAGE**ps,char*l)
     pst->ipcc = 0;                      /* input pipe connector count */
     pst->opcc = 0;                     /* output pipe connector count */
     pst->xpcc = 0;                     /* COMMON pipe connector count */
+    pst->ipcv = pst->opcv = pst->xpcv = NULL;  /* allocated on demand */
+    pst->pcvz = 0;
+    pst->path = NULL;                  /* not yet found along PIPEPATH */
     pst->cpid = -1;       /* PID of child process handling this stage */
+    pst->fuse = 0;                   /* runs in a process of its own */
 
 //  xfl_pipestage->prev = pst;       /* prev head points back to this */
     xfl_pipestage = pst;              /* and this one gets the anchor */
@@ -486,10 +2113,840 @@ int xfl_getpipepart(PIPESTAGE**ps,char*l)
     return 0;
   }
 
+/* -------------------------------------------------------- PIPEPARTCONN
+ *  Add a connector to a stage, as input or output according to its
+ *  flag and to the COMMON list in any case. There is no fixed limit:
+ *  the arrays grow together and are always terminated with a NULL.
+ *   Called by: launcher
+ */
+int xfl_pipepartconn(PIPESTAGE*ps,PIPECONN*px)
+  { static char _eyecatcher[] = "xfl_pipepartconn()";
+    void ***vv[3], **v;
+    int i, z;
+
+    /* need room for this one plus the NULL in each, else grow them   */
+    if (ps->xpcc + 2 > ps->pcvz)
+      { z = ps->pcvz * 2; if (z < 16) z = 16;
+        vv[0] = &ps->ipcv; vv[1] = &ps->opcv; vv[2] = &ps->xpcv;
+        for (i = 0; i < 3; i++)
+          { v = realloc(*vv[i],z * sizeof(void*));
+            if (v == NULL)
+              { char *msgv[2], em[16]; int en;
+                en = errno; /* hold onto the error value in case it resets */
+                perror("xfl_pipepartconn(): realloc()");  /* standard report */
+                sprintf(em,"%d",en); msgv[1] = em;  /* integer to string */
+                xfl_error(26,2,msgv,"LIB");   /* provide specific report */
+                return -1; }
+            *vv[i] = v; }
+        ps->pcvz = z; }
+
+    if (px->flag & XFL_F_INPUT)
+      { ps->ipcv[ps->ipcc++] = px;
+        ps->ipcv[ps->ipcc] = NULL; }             /* mark end of chain */
+    else
+      { ps->opcv[ps->opcc++] = px;
+        ps->opcv[ps->opcc] = NULL; }             /* mark end of chain */
+    ps->xpcv[ps->xpcc++] = px;
+    ps->xpcv[ps->xpcc] = NULL;                   /* mark end of chain */
+
+    return 0;
+  }
+
+/* ------------------------------------------------------------ PLANHASH
+ *  FNV-1a over the pipeline text and the characters which split it
+ *  into stages and pipelines. A cached plan is filed under this.
+ */
+unsigned int xfl_planhash(char*text,char*stagesep,char*endchar)
+  { unsigned int h;
+    char *sv[3], *p;
+    int i;
+
+    sv[0] = text; sv[1] = stagesep; sv[2] = endchar;
+    h = 2166136261u;
+    for (i = 0; i < 3; i++)
+      { for (p = sv[i]; p != NULL && *p != 0x00; p++)
+          { h ^= (unsigned char) *p; h *= 16777619u; }
+        h ^= 0xFF; h *= 16777619u; }     /* keep the three apart */
+    return h;
+  }
+
+/* a stage while the plan is being worked out: pieces of the text     */
+typedef struct XFLPLANWS {
+    int lo, ll;                 /* label offset and length, lo -1 none */
+    int vo, vl;                            /* verb, vl zero if none yet */
+    int ao, al;                           /* arguments, ao -1 if none */
+    int pnum, ipcc, opcc;
+                         } XFLPLANWS;
+
+typedef struct XFLPLANWORK {
+    char *text;
+    struct XFLPLANWS *sv;
+    int sc, sz;
+    struct XFLPLANCONN *cv;
+    int cc, cz;
+                           } XFLPLANWORK;
+
+/* ------------------------------------------------------------------ */
+static int xfl_planwstage(XFLPLANWORK*w)
+  { void *v;
+    if (w->sc + 1 > w->sz)
+      { w->sz = w->sz * 2 + 16;
+        v = realloc(w->sv,w->sz * sizeof(XFLPLANWS));
+        if (v == NULL) return -1;
+        w->sv = v; }
+    memset(&w->sv[w->sc],0x00,sizeof(XFLPLANWS));
+    w->sv[w->sc].lo = w->sv[w->sc].ao = -1;
+    return w->sc++;
+  }
+
+/* ------------------------------------------------------------------ */
+/* connect the next output stream of one stage to the next input of   */
+/* another, or to the input given if that has been numbered already  */
+static int xfl_planwconn(XFLPLANWORK*w,int from,int fromstream,
+                                  int to,int flag)
+  { void *v;
+    XFLPLANCONN *c;
+    if (w->cc + 1 > w->cz)
+      { w->cz = w->cz * 2 + 16;
+        v = realloc(w->cv,w->cz * sizeof(XFLPLANCONN));
+        if (v == NULL) return -1;
+        w->cv = v; }
+    c = &w->cv[w->cc++];
+    c->from = from;
+    c->fromstream = (fromstream < 0) ? w->sv[from].opcc++ : fromstream;
+    c->to = to;
+    c->tostream = w->sv[to].ipcc++;
+    c->flag = flag;
+    return 0;
+  }
+
+/* ------------------------------------------------------------------ */
+/* "parallel n [KEY range] stage args" brings n copies of the stage:  */
+/* output stream k of the parallel stage is the input of copy k, and  */
+/* the output of copy k comes back on its input stream k              */
+static int xfl_planparallel(XFLPLANWORK*w,int s)
+  { static char _eyecatcher[] = "xfl_planparallel()";
+    int n, k, c, vo, vl, ao, al, e;
+    char *t, *p, *q, *msgv[2], em[16];
+
+    t = w->text;
+    e = w->sv[s].ao + w->sv[s].al;               /* end of the args */
+    msgv[0] = "pipe";
+
+    /* the copies get connectors after the ones in the pipeline, so   */
+    /* those have to be there already to be streams zero              */
+    if (w->sv[s].ipcc == 0 || w->sv[s].opcc == 0)
+      { if (w->sv[s].ipcc == 0)
+        xfl_error(127,1,msgv,"PIP"); /* This stage cannot be first ... */
+        else { msgv[1] = "0";
+        xfl_error(102,2,msgv,"PIP"); }     /* Stream &1 not defined */
+        return -1; }
+
+    p = t + w->sv[s].ao;
+    n = strtol(p,&q,10);
+    if (q == p || (q < t + e && *q != ' ' && *q != '\t'))
+      { q = p;
+        while (q < t + e && *q != ' ' && *q != '\t') q++;
+        snprintf(em,sizeof(em),"%.*s",(int) (q - p),p);
+        msgv[1] = em;
+        xfl_error(58,2,msgv,"PIP");     /* Decimal number expected */
+        return -1; }
+    if (n < 1 || n > XFL_PARALLEL_MAX)
+      { sprintf(em,"%d",n); msgv[1] = em;
+        xfl_error(66,2,msgv,"PIP");   /* Number &1 is outside the range */
+        return -1; }
+
+    /* skip the KEY operand, which only the "parallel" stage needs    */
+    while (q < t + e && (*q == ' ' || *q == '\t')) q++;
+    if (t + e - q > 3 && strncasecmp(q,"KEY",3) == 0
+        && (q[3] == ' ' || q[3] == '\t'))
+      { q += 3;
+        while (q < t + e && (*q == ' ' || *q == '\t')) q++;
+        while (q < t + e && *q != ' ' && *q != '\t') q++;
+        while (q < t + e && (*q == ' ' || *q == '\t')) q++; }
+
+    /* what remains is the stage to run in parallel                   */
+    if (q >= t + e)
+      { msgv[1] = "";
+        xfl_error(11,2,msgv,"PIP");   /* Null or blank parameter list */
+        return -1; }
+    vo = q - t;
+    while (q < t + e && *q != ' ' && *q != '\t') q++;
+    vl = q - t - vo;
+    while (q < t + e && (*q == ' ' || *q == '\t')) q++;
+    if (q < t + e) { ao = q - t; al = e - ao; } else { ao = -1; al = 0; }
+
+    for (k = 1; k <= n; k++)
+      { c = xfl_planwstage(w);
+        if (c < 0) return -1;
+        w->sv[c].vo = vo; w->sv[c].vl = vl;
+        w->sv[c].ao = ao; w->sv[c].al = al;
+        w->sv[c].pnum = w->sv[s].pnum;
+        /* these are lock-step so the stage knows what came from what */
+        if (xfl_planwconn(w,s,-1,c,XFL_PLAN_LOCKSTEP) < 0) return -1;
+        if (xfl_planwconn(w,c,-1,s,XFL_PLAN_LOCKSTEP) < 0) return -1; }
+
+    return 0;
+  }
+
+/* ------------------------------------------------------------------ */
+/* copy a piece of the text into the plan, returning where it went    */
+static int xfl_planstr(XFLPLAN*pl,int*at,char*s,int len)
+  { int o;
+    if (s == NULL) return -1;
+    o = *at;
+    memcpy((char*) pl + o,s,len);
+    *((char*) pl + o + len) = 0x00;
+    *at = o + len + 1;
+    return o;
+  }
+
+/* ---------------------------------------------------------------- PLAN
+ *  Parse a pipeline specification into a plan of its stages, labels,
+ *  streams, and connectors. The text is not changed and nothing is
+ *  started, so this can be used to check a pipeline, or the plan can
+ *  be kept and used again. Free the plan with free() when done.
+ *  Returns: zero, or negative after reporting what is wrong
+ */
+int xfl_plan(char*text,char*stagesep,char*endchar,XFLPLAN**plan)
+  { static char _eyecatcher[] = "xfl_plan()";
+    XFLPLANWORK w0, *w = &w0;
+    XFLPLANWS *ws;
+    XFLPLANSTAGE *ps;
+    XFLPLAN *pl;
+    char *t, *msgv[2], em[16], sep, end, vb[16];
+    int p, q, r, l, n, s, i, pnum, pend, pendk, size, at;
+
+    *plan = NULL;
+    memset(w,0x00,sizeof(w0));
+    w->text = t = text;
+    sep = (stagesep != NULL && *stagesep != 0x00) ? *stagesep : '|';
+    end = (endchar != NULL) ? *endchar : 0x00;
+    msgv[0] = "pipe";
+    n = strlen(t);
+
+    /* step through the pipeline specification string                 */
+    p = 0; pnum = 1; pend = pendk = -1;
+    while (p < n)
+      {
+        q = p;
+        while (q < n && t[q] != sep && (end == 0x00 || t[q] != end)) q++;
+        /* we have a stage, from p up to q, followed by t[q]          */
+
+        r = p;
+        while (r < q && (t[r] == ' ' || t[r] == '\t')) r++;
+
+        /* peel-off any stage label */
+        l = r;
+        while (r < q && t[r] != ' ' && t[r] != '\t' && t[r] != ':') r++;
+        if (r < q && t[r] == ':')
+          { s = -1;             /* a label we have seen is the same stage */
+            for (i = 0; i < w->sc; i++)
+              if (w->sv[i].lo >= 0 && w->sv[i].ll == r - l
+                  && strncmp(t + w->sv[i].lo,t + l,r - l) == 0) s = i;
+            if (s < 0)
+              { if (r == l)
+                  { xfl_error(43,1,msgv,"PIP");       /* Null label */
+                    goto fail; }
+                s = xfl_planwstage(w);
+                if (s < 0) goto nomem;
+                w->sv[s].lo = l; w->sv[s].ll = r - l;
+                w->sv[s].pnum = pnum; }
+            else
+              { snprintf(em,sizeof(em),"%.*s",r - l,t + l); msgv[1] = em;
+                xfl_trace(3047,2,msgv,"PIP"); }    /* Label is re-used */
+            r++;
+            while (r < q && (t[r] == ' ' || t[r] == '\t')) r++;
+          } else {
+            r = l;
+            s = -1;
+                 }
+
+        /* the verb, and what follows it is the arguments             */
+        l = r;
+        while (r < q && t[r] != ' ' && t[r] != '\t') r++;
+        if (r > l)
+          { if (s < 0)
+              { s = xfl_planwstage(w);
+                if (s < 0) goto nomem;
+                w->sv[s].pnum = pnum; }
+            else if (w->sv[s].vl > 0)
+              { snprintf(em,sizeof(em),"%.*s",w->sv[s].ll,t + w->sv[s].lo);
+                msgv[1] = em;
+                xfl_error(47,2,msgv,"PIP");  /* Label already declared */
+                goto fail; }
+            w->sv[s].vo = l; w->sv[s].vl = r - l;
+            if (r < q) r++;
+            if (r < q) { w->sv[s].ao = r; w->sv[s].al = q - r; } }
+        if (s < 0)
+          { xfl_error(17,1,msgv,"PIP");             /* Null stage found */
+            goto fail; }
+
+        /* input here is the output of the stage before, if any       */
+        if (pend >= 0 && xfl_planwconn(w,pend,pendk,s,0) < 0)
+            goto nomem;
+
+        /* and output goes to the stage after, which is yet to come   */
+        pend = -1;
+        if (q < n && t[q] == sep)
+          { pend = s; pendk = w->sv[s].opcc++; }
+        else if (q < n) pnum++;     /* endchar: next pipeline follows */
+
+        /* a "parallel" stage brings its copies along with it          */
+        ws = &w->sv[s];
+        if (ws->vl > 0 && ws->vo == l && ws->vl < sizeof(vb))
+          { char *v;
+            memcpy(vb,t + l,ws->vl); vb[ws->vl] = 0x00;
+            if (ws->ao >= 0 && (v = xfl_stageverb(vb)) != NULL
+                && strcmp(v,"parallel") == 0)
+                if (xfl_planparallel(w,s) < 0) goto fail; }
+
+        p = (q < n) ? q + 1 : q;
+      }
+
+    /* a stage separator at the very end leaves a stage with no input */
+    if (pend >= 0 || n == 0)
+      { xfl_error(n == 0 ? 12 : 17,1,msgv,"PIP");
+        goto fail; }
+
+    /* every label used must name a stage somewhere                   */
+    for (s = 0; s < w->sc; s++)
+      if (w->sv[s].vl == 0)
+        { snprintf(em,sizeof(em),"%.*s",w->sv[s].ll,t + w->sv[s].lo);
+          msgv[1] = em;
+          xfl_error(46,2,msgv,"PIP");         /* Label &1 not declared */
+          goto fail; }
+
+    /* now all of it into one block                                   */
+    size = sizeof(XFLPLAN) + w->sc * sizeof(XFLPLANSTAGE)
+         + w->cc * sizeof(XFLPLANCONN) + n + 1 + 2 + 2;
+    for (s = 0; s < w->sc; s++)
+      { ws = &w->sv[s];
+        if (ws->lo >= 0) size += ws->ll + 1;
+        size += ws->vl + 1;
+        if (ws->ao >= 0) size += ws->al + 1; }
+
+    pl = malloc(size);
+    if (pl == NULL) goto nomem;
+    memset(pl,0x00,size);
+    pl->magic = XFL_PLAN_MAGIC;
+    pl->level = XFL_PLAN_LEVEL;
+    pl->size = size;
+    pl->hash = xfl_planhash(text,stagesep,endchar);
+    pl->stagec = w->sc;
+    pl->connc = w->cc;
+
+    at = (char*) (XFL_PLAN_CONN(pl) + pl->connc) - (char*) pl;
+    pl->text = xfl_planstr(pl,&at,t,n);
+    pl->stagesep = xfl_planstr(pl,&at,&sep,1);
+    pl->endchar = xfl_planstr(pl,&at,&end,end == 0x00 ? 0 : 1);
+    ps = XFL_PLAN_STAGE(pl);
+    for (s = 0; s < w->sc; s++)
+      { ws = &w->sv[s];
+        ps[s].label = (ws->lo < 0) ? -1
+                    : xfl_planstr(pl,&at,t + ws->lo,ws->ll);
+        ps[s].verb = xfl_planstr(pl,&at,t + ws->vo,ws->vl);
+        ps[s].args = (ws->ao < 0) ? -1
+                   : xfl_planstr(pl,&at,t + ws->ao,ws->al);
+        ps[s].pnum = ws->pnum;
+        ps[s].ipcc = ws->ipcc;
+        ps[s].opcc = ws->opcc; }
+    memcpy(XFL_PLAN_CONN(pl),w->cv,w->cc * sizeof(XFLPLANCONN));
+
+    free(w->sv);
+    free(w->cv);
+    *plan = pl;
+    return 0;
+
+nomem:
+      { int en;
+        en = errno;    /* hold onto the error value in case it resets */
+        perror("xfl_plan(): malloc()");            /* standard report */
+        sprintf(em,"%d",en); msgv[1] = em;       /* integer to string */
+        xfl_error(26,2,msgv,"LIB"); }      /* provide specific report */
+fail:
+    free(w->sv);
+    free(w->cv);
+    return -1;
+  }
+
+/* ----------------------------------------------------------- PLANCHECK
+ *  Find every stage of a plan, so a pipeline with a misspelled stage
+ *  is reported before any of it gets underway. Starts nothing.
+ *  Returns: zero if all were found, else negative after reporting
+ */
+int xfl_plancheck(XFLPLAN*pl)
+  { static char _eyecatcher[] = "xfl_plancheck()";
+    XFLPLANSTAGE *ps;
+    char path[8192], *verb, *args, *msgv[2];
+    int s;
+
+    msgv[0] = "pipe";
+    ps = XFL_PLAN_STAGE(pl);
+    for (s = 0; s < pl->stagec; s++)
+      { verb = XFL_PLAN_STR(pl,ps[s].verb);
+        if (xfl_stagefind(verb,path,sizeof(path)) >= 0) continue;
+        msgv[1] = verb;
+        xfl_error(27,2,msgv,"PIP");     /* Entry point &1 not found */
+        args = XFL_PLAN_STR(pl,ps[s].args);
+        if (args != NULL && *args != 0x00)
+          { snprintf(path,sizeof(path),"%s %s",verb,args);
+            msgv[1] = path; }
+        xfl_error(1,2,msgv,"PIP");                 /* Running "&1" */
+        return -1; }
+
+    return 0;
+  }
+
+#ifdef XFL_THREADS
+/* ------------------------------------------------------------ PLANFUSE
+ *  Supplied stages built as modules which are connected to each other
+ *  are fused: each run of them shares one process, a thread apiece,
+ *  and passes records through memory instead of the kernel.
+ *  Sets fuse[s] to the run stage s is in, or zero if it is on its own.
+ */
+static void xfl_planfuse(XFLPLAN*pl,int*fuse)
+  { XFLPLANSTAGE *ps;
+    XFLPLANCONN *pc;
+    char *p, *verb, path[8192];
+    int s, c, a, b, n;
+
+    ps = XFL_PLAN_STAGE(pl);
+    pc = XFL_PLAN_CONN(pl);
+    for (s = 0; s < pl->stagec; s++) fuse[s] = 0;
+
+    p = getenv("PIPEOPT_FUSE");
+    if (p != NULL && (*p == '0' || *p == 'n' || *p == 'N')) return;
+
+    /* each stage which can be fused starts out as a run of its own   */
+    for (s = 0; s < pl->stagec; s++)
+      { verb = XFL_PLAN_STR(pl,ps[s].verb);
+        if (xfl_stageverb(verb) == NULL) continue;
+        if (xfl_stagefind(verb,path,sizeof(path)) < 0) continue;
+        if (xfl_stagemodule(path) == NULL) continue;
+        fuse[s] = s + 1; }
+
+    /* then each connector between two of them joins up their runs    */
+    for (c = 0; c < pl->connc; c++)
+      { a = fuse[pc[c].from]; b = fuse[pc[c].to];
+        if (a == 0 || b == 0 || a == b) continue;
+        if (a > b) { n = a; a = b; b = n; }
+        for (s = 0; s < pl->stagec; s++) if (fuse[s] == b) fuse[s] = a; }
+
+    /* and a run of one stage is just a stage                         */
+    for (s = 0; s < pl->stagec; s++)
+      { if (fuse[s] == 0) continue;
+        for (n = 0, c = 0; c < pl->stagec; c++) if (fuse[c] == fuse[s]) n++;
+        if (n < 2) fuse[s] = 0; }
+  }
+#else
+#define xfl_planfuse(pl,fuse) memset(fuse,0x00,(pl)->stagec * sizeof(int))
+#endif
+
+/* ---------------------------------------------------------- PLANSTAGES
+ *  Make the stage structs and connectors for a plan, ready to launch.
+ *  The stage structs point into the plan, so keep it until they go.
+ *  Returns: zero, or negative after reporting an error
+ */
+int xfl_planstages(XFLPLAN*pl)
+  { static char _eyecatcher[] = "xfl_planstages()";
+    XFLPLANSTAGE *ps;
+    XFLPLANCONN *pc;
+    PIPESTAGE **sv;
+    PIPECONN **cv, *pp[3];
+    int s, c, k, rc, *fuse;
+
+    ps = XFL_PLAN_STAGE(pl);
+    pc = XFL_PLAN_CONN(pl);
+    sv = malloc((pl->stagec + 1) * sizeof(PIPESTAGE*));
+    cv = malloc((pl->connc * 2 + 1) * sizeof(PIPECONN*));
+    fuse = malloc((pl->stagec + 1) * sizeof(int));
+    if (sv == NULL || cv == NULL || fuse == NULL)
+      { free(sv); free(cv); free(fuse); return -1; }
+    xfl_planfuse(pl,fuse);
+
+    for (s = 0; s < pl->stagec; s++)
+      { sv[s] = NULL;
+        xfl_getpipepart(&sv[s],XFL_PLAN_STR(pl,ps[s].label));
+        if (sv[s] == NULL) { rc = -1; goto done; }
+        sv[s]->arg0 = XFL_PLAN_STR(pl,ps[s].verb);
+        sv[s]->args = XFL_PLAN_STR(pl,ps[s].args);
+        sv[s]->fuse = fuse[s]; }
+
+    /* [2c] is the output side of connector c and [2c+1] the input    */
+    for (c = 0; c < pl->connc; c++)
+      { xfl_lockstep = (pc[c].flag & XFL_PLAN_LOCKSTEP);
+        xfl_inring = (fuse[pc[c].from] != 0
+                   && fuse[pc[c].from] == fuse[pc[c].to]);
+        rc = xfl_pipepair(pp);
+        xfl_lockstep = xfl_inring = 0;
+        if (rc != 0) { rc = -1; goto done; }
+        cv[2*c] = pp[1];
+        cv[2*c+1] = pp[0]; }
+
+    /* each stage numbers its streams by the order they are added     */
+    rc = 0;
+    for (s = 0; s < pl->stagec; s++)
+      { for (k = 0; k < ps[s].ipcc; k++)
+          for (c = 0; c < pl->connc; c++)
+            if (pc[c].to == s && pc[c].tostream == k
+                && xfl_pipepartconn(sv[s],cv[2*c+1]) < 0) rc = -1;
+        for (k = 0; k < ps[s].opcc; k++)
+          for (c = 0; c < pl->connc; c++)
+            if (pc[c].from == s && pc[c].fromstream == k
+                && xfl_pipepartconn(sv[s],cv[2*c]) < 0) rc = -1; }
+
+done:
+    free(sv);
+    free(cv);
+    free(fuse);
+    return rc;
+  }
+
+/* ------------------------------------------------------------ PLANSAVE
+ *  Write a plan to a file, by way of a temporary and a rename so that
+ *  another launcher never reads half of one.
+ *  Returns: zero, or negative errno (a cache is no reason to complain)
+ */
+int xfl_plansave(XFLPLAN*pl,char*file)
+  { static char _eyecatcher[] = "xfl_plansave()";
+    char temp[8192];
+    int fd, rc;
+
+    /* ours alone, and a new file, not one somebody left lying there */
+    snprintf(temp,sizeof(temp),"%s.%d",file,(int) getpid());
+    unlink(temp);
+    fd = open(temp,O_WRONLY|O_CREAT|O_EXCL,0600);
+    if (fd < 0) return -errno;
+    rc = write(fd,pl,pl->size);
+    if (rc != (int) pl->size)
+      { rc = (rc < 0) ? -errno : -EIO;
+        close(fd); unlink(temp); return rc; }
+    close(fd);
+    if (rename(temp,file) < 0) { rc = -errno; unlink(temp); return rc; }
+    return 0;
+  }
+
+/* ------------------------------------------------------------ PLANLOAD
+ *  Read back a plan written by xfl_plansave(), checking it over first
+ *  since it came from outside. Only a plain file of the user's own,
+ *  which no one else may write, is taken: a plan says what to run.
+ *  Free the plan with free() when done.
+ *  Returns: zero, or negative if there is no usable plan in the file
+ */
+int xfl_planload(char*file,XFLPLAN**plan)
+  { static char _eyecatcher[] = "xfl_planload()";
+    XFLPLAN *pl;
+    XFLPLANSTAGE *ps;
+    XFLPLANCONN *pc;
+    struct stat st;
+    int fd, rc, s, c, lo, *ov[4];
+
+    *plan = NULL;
+    fd = open(file,O_RDONLY);
+    if (fd < 0) return -errno;
+    if (fstat(fd,&st) < 0 || !S_ISREG(st.st_mode)
+                          || st.st_uid != getuid() || (st.st_mode & 022))
+      { close(fd); return -EPERM; }
+    if (st.st_size < (off_t) sizeof(XFLPLAN) || st.st_size > 16777216)
+      { close(fd); return -EINVAL; }
+    pl = malloc(st.st_size);
+    if (pl == NULL) { close(fd); return -ENOMEM; }
+    rc = read(fd,pl,st.st_size);
+    close(fd);
+    if (rc != st.st_size) { free(pl); return -EIO; }
+
+    /* the header, then that the tables fit, then that all points in */
+    rc = -EINVAL;
+    if (pl->magic != XFL_PLAN_MAGIC || pl->level != XFL_PLAN_LEVEL
+        || pl->size != st.st_size || pl->stagec < 0 || pl->connc < 0
+        || pl->stagec > 65536 || pl->connc > 65536) goto bad;
+    lo = (char*) (XFL_PLAN_CONN(pl) + pl->connc) - (char*) pl;
+    if (lo >= pl->size || *((char*) pl + pl->size - 1) != 0x00) goto bad;
+    ov[0] = &pl->text; ov[1] = &pl->stagesep; ov[2] = &pl->endchar;
+    for (c = 0; c < 3; c++) if (*ov[c] < lo || *ov[c] >= pl->size) goto bad;
+    ps = XFL_PLAN_STAGE(pl);
+    for (s = 0; s < pl->stagec; s++)
+      { ov[0] = &ps[s].label; ov[1] = &ps[s].verb; ov[2] = &ps[s].args;
+        for (c = 0; c < 3; c++)
+          if ((*ov[c] != -1 || c == 1) && (*ov[c] < lo || *ov[c] >= pl->size))
+              goto bad;
+        if (ps[s].ipcc < 0 || ps[s].opcc < 0) goto bad; }
+    pc = XFL_PLAN_CONN(pl);
+    for (c = 0; c < pl->connc; c++)
+      if (pc[c].from < 0 || pc[c].from >= pl->stagec
+          || pc[c].to < 0 || pc[c].to >= pl->stagec
+          || pc[c].fromstream < 0 || pc[c].fromstream >= ps[pc[c].from].opcc
+          || pc[c].tostream < 0 || pc[c].tostream >= ps[pc[c].to].ipcc)
+          goto bad;
+
+    *plan = pl;
+    return 0;
+
+bad:
+    free(pl);
+    return rc;
+  }
+
 /* ------------------------------------------------------------------ */
 /* routines used by the stages follow                                 */
 /* ------------------------------------------------------------------ */
 
+/* this stage's connectors by stream number, one table per direction, */
+/* [0] for input and [1] for output, built up by xfl_stagestart()     */
+static XFL_TLS PIPECONN **xfl_streamv[2] = { NULL, NULL };
+static XFL_TLS int xfl_streamc[2] = { 0, 0 }; /* highest stream num + 1 */
+static XFL_TLS int xfl_streamz[2] = { 0, 0 };  /* room in the table above */
+
+static pid_t xfl_stagepid = 0;     /* process which ran xfl_stagestart */
+
+/* ----------------------------------------------------------- STAGEEXIT
+ *  A stage which returns from main() without calling xfl_stagequit()
+ *  would leave its neighbours waiting to notice that it is gone, so
+ *  sever whatever it left connected. Not in any child it may fork.
+ */
+static void xfl_stageexit()
+  { int d, k;
+    if (getpid() != xfl_stagepid) return;
+    for (d = 0; d < 2; d++)
+      for (k = 0; k < xfl_streamc[d]; k++)
+        if (xfl_streamv[d][k] != NULL) xfl_sever(xfl_streamv[d][k]);
+  }
+
+#ifdef XFL_THREADS
+/* ----------------------------------------------------------- STAGELEFT
+ *  The same for a stage thread, which must also give back the storage
+ *  because the process goes on without it.
+ */
+static void xfl_stageleft()
+  { int d, k;
+    for (d = 0; d < 2; d++)
+      { for (k = 0; k < xfl_streamc[d]; k++)
+          if (xfl_streamv[d][k] != NULL)
+            { xfl_sever(xfl_streamv[d][k]); free(xfl_streamv[d][k]); }
+        free(xfl_streamv[d]); xfl_streamv[d] = NULL;
+        xfl_streamc[d] = xfl_streamz[d] = 0; }
+#ifdef XFL_URING
+    xfl_uringfree();
+#endif
+  }
+#endif
+
+#ifdef XFL_THREADS
+/* ------------------------------------------------------------------ */
+/* A stage built as a shared object (verb.so beside the executable,   */
+/* with its main() renamed xfl_stagemain) can run as a thread of the  */
+/* launcher. Its connectors are the same as for a process, so with    */
+/* the shared memory transport records go from thread to thread       */
+/* through memory, and a neighbour which is a process works as usual. */
+
+typedef struct XFLTHREAD {
+    pthread_t tid;
+    int (*stagemain)(int,char*[]);        /* entry point of the stage */
+    char *argv[3];                        /* verb, arguments, and NULL */
+    char *conn;                       /* "PIPECONN=..." for this stage */
+    int rc;                          /* what the stage main() returned */
+    struct XFLTHREAD *next;
+                          } XFLTHREAD;
+
+static struct XFLTHREAD *xfl_threads = NULL;   /* the launcher joins them */
+
+/* ------------------------------------------------------------ STAGERUN
+ *  body of each stage thread
+ */
+static void *xfl_stagerun(void*arg)
+  { struct XFLTHREAD *st;
+
+    st = arg;
+    xfl_stageconn = st->conn + sizeof("PIPECONN=") - 1;
+    st->rc = st->stagemain(st->argv[1] != NULL ? 2 : 1,st->argv);
+
+    /* as at the exit of a process: sever what is left, flush output  */
+    xfl_stageleft();
+    fflush(stdout);
+    return NULL;
+  }
+
+/* --------------------------------------------------------- STAGETHREAD
+ *  Run the stage as a thread if it was built to be loaded that way.
+ *   Called by: launcher
+ *  Returns: zero if started, positive if the stage should be spawned
+ *  as a process after all, negative for an error
+ */
+int xfl_stagethread(int argc,char*argv[],PIPECONN*pc[],PIPESTAGE*sx)
+  { static char _eyecatcher[] = "xfl_stagethread()";
+    char path[8192], *msgv[2];
+    int (*stagemain)(int,char*[]);
+    struct XFLTHREAD *st;
+    int i, rc;
+
+    if (sx != NULL && sx->path != NULL)
+      { strncpy(path,sx->path,sizeof(path)-1); path[sizeof(path)-1] = 0x00; }
+    else if (xfl_stagefind(argv[0],path,sizeof(path)) < 0) return 1;
+    stagemain = xfl_stagemodule(path);
+    if (stagemain == NULL) return 1;       /* not built as a module */
+
+    st = calloc(1,sizeof(struct XFLTHREAD));
+    if (st == NULL) { perror("xfl_stagethread(): calloc()"); return -1; }
+    st->stagemain = stagemain;
+
+    /* the launcher lets go of its copy of the arguments, so copy them */
+    st->argv[0] = strdup(argv[0]);
+    st->argv[1] = (argc > 1 && argv[1] != NULL) ? strdup(argv[1]) : NULL;
+    st->conn = xfl_stageconnstr(pc);
+    if (st->argv[0] == NULL || st->conn == NULL)
+      { free(st->argv[0]); free(st->argv[1]); free(st->conn); free(st);
+        return -1; }
+
+    i = xfl_stageplace(sx,argv[0]);      /* new thread inherits it */
+    rc = pthread_create(&st->tid,NULL,xfl_stagerun,st);
+    if (i) xfl_stageunplace();
+    if (rc != 0)
+      { errno = rc; perror("xfl_stagethread(): pthread_create()");
+        free(st->argv[0]); free(st->argv[1]); free(st->conn); free(st);
+        return -1; }
+    st->next = xfl_threads;
+    xfl_threads = st;
+
+    /* the thread owns these descriptors now, the launcher must not   */
+    /* close them                                                     */
+    for (i = 0; pc[i] != NULL; i++)
+      { pc[i]->cpid = getpid();
+        pc[i]->flag &= ~XFL_F_KEEP;
+        pc[i]->flag |= XFL_F_THREAD; }
+    if (sx != NULL) sx->cpid = getpid();
+
+    msgv[1] = argv[0];
+    xfl_trace(3101,2,msgv,"LIB");
+
+    return 0;
+  }
+
+/* ----------------------------------------------------------- STAGEJOIN
+ *  Wait for all stage threads to finish.
+ *   Called by: launcher
+ *  Returns: number of stage threads which returned non-zero
+ */
+int xfl_stagejoin()
+  { static char _eyecatcher[] = "xfl_stagejoin()";
+    struct XFLTHREAD *st;
+    int n;
+
+    n = 0;
+    while (xfl_threads != NULL)
+      { st = xfl_threads;
+        pthread_join(st->tid,NULL);
+        if (st->rc != 0) n++;
+        xfl_threads = st->next;
+        free(st->argv[0]); free(st->argv[1]); free(st->conn); free(st); }
+
+    return n;
+  }
+
+/* ----------------------------------------------------------- STAGEFUSE
+ *  Start the run of fused stages which this one is in (see PLANFUSE)
+ *  as one process, each stage a thread of it. The launcher calls this
+ *  for every stage of the run and the first call starts all of them.
+ *  Returns: zero if started, positive if the stage is not fused,
+ *  negative for an error
+ */
+int xfl_stagefuse(PIPESTAGE*sx)
+  { static char _eyecatcher[] = "xfl_stagefuse()";
+    PIPESTAGE *sy;
+    PIPECONN *px, **pc;
+    char *msgv[2], *argv[3], list[256];
+    int i, n, rc;
+    pid_t pid;
+
+    if (sx == NULL || sx->fuse == 0) return 1;
+    if (sx->cpid > 0) return 0;          /* started along with another */
+
+    fflush(NULL);        /* else what is buffered comes out twice */
+    pid = fork();
+    if (pid < 0) { perror("xfl_stagefuse(): fork()"); return -1; }
+    if (pid == 0)
+      { /* keep only the connectors of this run, as for a warm stage  */
+        if (xfl_daemonfd >= 0) close(xfl_daemonfd);
+        for (px = xfl_pipeconn; px != NULL; px = px->next)
+          { for (sy = xfl_pipestage; sy != NULL; sy = sy->next)
+              { if (sy->fuse != sx->fuse || sy->xpcv == NULL) continue;
+                pc = (PIPECONN**) sy->xpcv;
+                i = 0;
+                while (pc[i] != NULL && pc[i] != px) i++;
+                if (pc[i] != NULL) break; }
+            if (sy != NULL) continue;
+            close(px->fdf);
+            if (px->fdr != px->fdf) close(px->fdr);
+            if (px->fdm >= 0) close(px->fdm); }
+
+        rc = 0;
+        for (sy = xfl_pipestage; sy != NULL; sy = sy->next)
+          { if (sy->fuse != sx->fuse) continue;
+            argv[0] = sy->arg0; argv[1] = sy->args; argv[2] = NULL;
+            n = (argv[1] != NULL && *argv[1] != 0x00) ? 2 : 1;
+            if (xfl_stagethread(n,argv,(PIPECONN**) sy->xpcv,sy) != 0
+             && xfl_stagespawn(n,argv,(PIPECONN**) sy->xpcv,sy) < 0)
+                rc = 1; }
+        if (xfl_stagejoin() > 0) rc = 1;
+        while (wait(NULL) > 0);               /* any it had to spawn */
+        exit(rc); }
+
+    /* the run has these now; and say which stages are in it          */
+    list[0] = 0x00;
+    for (sy = xfl_pipestage; sy != NULL; sy = sy->next)
+      { if (sy->fuse != sx->fuse) continue;
+        pc = (PIPECONN**) sy->xpcv;
+        for (i = 0; pc != NULL && pc[i] != NULL; i++)
+          { pc[i]->cpid = pid;
+            pc[i]->flag &= ~XFL_F_KEEP; }
+        sy->cpid = pid;
+        n = strlen(list);
+        snprintf(list + n,sizeof(list) - n,"%s%s",
+                                         n > 0 ? " " : "",sy->arg0); }
+    msgv[1] = list;
+    xfl_trace(3104,2,msgv,"LIB");
+
+    return 0;
+  }
+#else
+/* without threads every stage is a process: tell the caller to spawn */
+int xfl_stagethread(int argc,char*argv[],PIPECONN*pc[],PIPESTAGE*sx)
+  { return 1; }
+int xfl_stagejoin() { return 0; }
+int xfl_stagefuse(PIPESTAGE*sx) { return 1; }
+#endif
+
+/* ----------------------------------------------------------- STREAMPUT
+ *  File a connector in the stream table for its direction. A numbered
+ *  connector goes in that slot, any other in the next one after the
+ *  highest so far, and its number is filled in to match.
+ */
+static int xfl_streamput(PIPECONN*pc)
+  { PIPECONN **v;
+    int d, k, z;
+
+    d = (pc->flag & XFL_F_OUTPUT) ? 1 : 0;
+    if (pc->n < 0) pc->n = xfl_streamc[d];
+    k = pc->n;
+
+    if (k >= xfl_streamz[d])
+      { z = xfl_streamz[d] * 2; if (z < 16) z = 16;
+        while (z <= k) z = z * 2;
+        v = realloc(xfl_streamv[d],z * sizeof(PIPECONN*));
+        if (v == NULL) return -1;
+        memset(&v[xfl_streamz[d]],0x00,
+                (z - xfl_streamz[d]) * sizeof(PIPECONN*));
+        xfl_streamv[d] = v; xfl_streamz[d] = z; }
+
+    /* 2811 E A stream with the stream identifier specified is already defined. */
+    if (xfl_streamv[d][k] != NULL)
+      { xfl_errno = XFL_E_2811; return -1; }
+
+    xfl_streamv[d][k] = pc;
+    if (k >= xfl_streamc[d]) xfl_streamc[d] = k + 1;
+    return 0;
+  }
+
 /* ---------------------------------------------------------- STAGESTART
  * initialize the internal input and output connectors (two fd each)
  */
@@ -506,7 +2963,9 @@ int xfl_stagestart(PIPECONN**pc)
 n = 0;
 
     /* connectors are passed to stages as matched file descriptors    */
-    pipeconn = getenv("PIPECONN");
+    /* (in the environment, or directly to a stage run as a thread)   */
+    pipeconn = xfl_stageconn;
+    if (pipeconn == NULL) pipeconn = getenv("PIPECONN");
     if (pipeconn == NULL) return 0;        /* FIXME: this is an error */
 //printf("stagestart: PIPECONN='%s'\n",pipeconn);
 
@@ -514,6 +2973,10 @@ n = 0;
     p = pipeconn;
     while (*p != 0x00 && *p != ' ')
       {
+        memset(&pc0,0x00,sizeof(pc0));
+        pc0.fdm = -1;                       /* default is pipes alone */
+        pc0.n = -1;               /* stream number not yet determined */
+
         if (*p == '*') p++;        /* skip past "*." to I/O indicator */
         if (*p == '.') p++;            /* else throw error number 191 */
 
@@ -532,7 +2995,17 @@ n = 0;
             for (i = 0; i < sizeof(number) - 1 &&
                         *p != 0x00 && *p != ' ' && *p != '.' && *p != ':' && *p != ','; i++)
                 number[i] = *p++;
-            number[i] = 0x00; pc0.n = atoi(number);
+            number[i] = 0x00;
+            for (i = 0; number[i] >= '0' && number[i] <= '9'; i++);
+            if (i > 0 && number[i] == 0x00) pc0.n = atoi(number);
+                else strncpy(pc0.name,number,sizeof(pc0.name) - 1);
+            if (*p == ',')          /* the shared memory ring, if any */
+              { p++;
+                number[0] = 0x00;
+                for (i = 0; i < sizeof(number) - 1 &&
+                        *p != 0x00 && *p != ' ' && *p != '.' && *p != ':' && *p != ','; i++)
+                    number[i] = *p++;
+                number[i] = 0x00; pc0.fdm = atoi(number); }
         while (*p != 0x00 && *p != ' ' && *p != '.' && *p != ':') p++;
  }
 //printf("after2 '%s'\n",p);
@@ -552,6 +3025,20 @@ n = 0;
                 number[i] = *p++;
             number[i] = 0x00; pc0.fdr = atoi(number); }
 
+        /* data and control on the same descriptor means a socket     */
+        if (pc0.fdf == pc0.fdr) pc0.flag |= XFL_F_SEQPKT;
+
+#ifdef XFL_SHMEM
+        /* map the ring now, and see below if the other side does too  */
+        if (pc0.fdm >= 0 && xfl_shmattach(&pc0) < 0)
+          { char *msgv[2], em[16]; int en;
+            en = errno;    /* hold onto the error value in case it resets */
+            perror("xfl_stagestart(): mmap()");    /* standard report */
+            sprintf(em,"%d",en); msgv[1] = em;   /* integer to string */
+            xfl_error(26,2,msgv,"LIB");    /* provide specific report */
+            return -1; }
+#endif
+
         pc0.next = NULL;                                /* STAGESTART */
         pc0.prev = *pc;                                 /* STAGESTART */
 
@@ -563,17 +3050,81 @@ n = 0;
         pcp = pc1;
 n = n + 1;
 
+        /* so that stages can go straight to a stream by its number   */
+        if (xfl_streamput(pc1) < 0)
+          { fprintf(stderr,"xfl_stagestart(): stream %d '%s' not added\n",
+                pc1->n,pc1->name);
+            return -1; }
+
         while (*p != 0x00 && *p == ' ') p++;
       }
 
 //printf("xfl_stagestart: %d connectors\n",n);      // can discard variable "n"
 
+#ifdef XFL_SHMEM
+    /* a ring is only any use if the stage at the other end maps it   */
+    xfl_shmagree(*pc);
+#endif
+
     /* be sure that stages won't get whacked by SIGPIPE on connectors */
     signal(SIGPIPE,SIG_IGN);
 
+    /* and that an early return still tells the neighbours we are gone */
+    /* (a stage thread is looked after by the launcher instead)       */
+    if (xfl_stageconn != NULL) return 0;
+    if (xfl_stagepid == 0) atexit(xfl_stageexit);
+    xfl_stagepid = getpid();
+
     return 0;
   }
 
+/* --------------------------------------------------------- INPUT_STREAM
+ *  Returns: the input connector for stream number "n", or NULL
+ */
+PIPECONN *xfl_input_stream(int n)
+  { if (n < 0 || n >= xfl_streamc[0]) return NULL;
+    return xfl_streamv[0][n]; }
+
+/* -------------------------------------------------------- OUTPUT_STREAM
+ *  Returns: the output connector for stream number "n", or NULL
+ */
+PIPECONN *xfl_output_stream(int n)
+  { if (n < 0 || n >= xfl_streamc[1]) return NULL;
+    return xfl_streamv[1][n]; }
+
+/* --------------------------------------------------------------- STREAM
+ *  Look up a connector by stream identifier, as in CMS Pipelines:
+ *  either a number or the name given to the stream. "flag" says
+ *  which direction, XFL_F_INPUT or XFL_F_OUTPUT.
+ *  Returns: the connector, or NULL if there is no such stream
+ */
+PIPECONN *xfl_stream(char*id,int flag)
+  { static char _eyecatcher[] = "xfl_stream()";
+    int d, k;
+
+    if (id == NULL) { xfl_errno = XFL_E_NULLPTR; return NULL; }
+    d = (flag & XFL_F_OUTPUT) ? 1 : 0;
+
+    /* a number goes right to its slot                                */
+    for (k = 0; id[k] >= '0' && id[k] <= '9'; k++);
+    if (k > 0 && id[k] == 0x00)
+      return (d ? xfl_output_stream(atoi(id)) : xfl_input_stream(atoi(id)));
+
+    /* a name has to be looked for, but there are never very many     */
+    for (k = 0; k < xfl_streamc[d]; k++)
+      if (xfl_streamv[d][k] != NULL &&
+          strcmp(xfl_streamv[d][k]->name,id) == 0) return xfl_streamv[d][k];
+
+    return NULL;
+  }
+
+/* -------------------------------------------------------------- STREAMS
+ *  Returns: how many streams in the direction given by "flag",
+ *  which is one more than the highest stream number
+ */
+int xfl_streams(int flag)
+  { return xfl_streamc[(flag & XFL_F_OUTPUT) ? 1 : 0]; }
+
 /* ----------------------------------------------------------- STAGEQUIT
  *  do an orderly close of the file descriptors and release of storage
  */
@@ -597,11 +3148,190 @@ int xfl_stagequit(PIPECONN*pc)
         pc = pn;
       }
 
+    /* the stream tables only pointed at what was just freed          */
+    free(xfl_streamv[0]); free(xfl_streamv[1]);
+    xfl_streamv[0] = xfl_streamv[1] = NULL;
+    xfl_streamc[0] = xfl_streamc[1] = 0;
+    xfl_streamz[0] = xfl_streamz[1] = 0;
+
+#ifdef XFL_URING
+    xfl_uringfree();                   /* a thread must give it back */
+#endif
+
 //  closelog();
 
+    /* report how waiting went, if we were asked to spin              */
+    if (xfl_spinus > 0)
+      { char *msgv[4], em[3][24];
+        sprintf(em[0],"%d",getpid()); msgv[1] = em[0];
+        sprintf(em[1],"%ld",xfl_spunhits); msgv[2] = em[1];
+        sprintf(em[2],"%ld",xfl_spunouts); msgv[3] = em[2];
+        xfl_trace(3100,4,msgv,"LIB"); }
+
     return 0;
   }
 
+/* ---------------------------------------------------------------------
+ *  Discard "count" bytes of record content still sitting in the pipe.
+ */
+static void xfl_fetchskip(PIPECONN*pc,int count)
+  { char drain[4096];
+    int rc;
+
+    /* a message socket drops whatever part of a message we do not    */
+    /* take, so count messages by their real length (MSG_TRUNC)       */
+    if (pc->flag & XFL_F_SEQPKT)
+      { if (pc->flag & XFL_F_FTCHHDR)
+          { rc = recv(pc->fdf,drain,sizeof(drain),MSG_TRUNC);
+            if (rc > 0) count = count - (rc - sizeof(struct XFLFRAME));
+            pc->flag &= ~XFL_F_FTCHHDR; }
+        while (count > 0)
+          { rc = recv(pc->fdf,drain,sizeof(drain),MSG_TRUNC);
+            if (rc <= 0) break;
+            count = count - rc; }
+        pc->flag &= ~XFL_F_FTCHDAT; pc->poff = 0;
+        return; }
+
+    while (count > 0)
+      { rc = xfl_readfull(pc->fdf,drain,
+                count < sizeof(drain) ? count : sizeof(drain));
+        if (rc <= 0) break;
+        count = count - rc; }
+    pc->flag &= ~XFL_F_FTCHDAT; pc->poff = 0;
+  }
+
+/* --------------------------------------------------------------- FETCH
+ *  CONSUMER SIDE, pipe protocol level 3 and above
+ *  One "FTCH" brings back a binary frame header immediately followed
+ *  by the record content, so examining a record costs a single round trip.
+ *  The reply may already be on its way if "NXFT" asked for it early.
+ *  The content is scattered into the pieces described by "vec".
+ *  With no pieces this returns the length and leaves the content for
+ *  the next call to pick up.
+ */
+static int xfl_fetchv(PIPECONN*pc,const struct iovec*vec,int cnt)
+  { static char _eyecatcher[] = "xfl_fetchv()";
+    int rc, reclen, got, buflen, k, pre;
+    struct iovec iov[XFL_IOV_MAX+1];
+    struct XFLFRAME fh;
+    struct msghdr mh;
+
+    buflen = 0;
+    for (k = 0; k < cnt; k++) buflen = buflen + vec[k].iov_len;
+
+    /* content already handed over in pieces cannot be had again as a */
+    /* whole, so discard the rest and ask the producer to send it anew */
+    if ((pc->flag & XFL_F_FTCHDAT) && pc->poff > 0)
+        xfl_fetchskip(pc,pc->plen - pc->poff);
+
+    /* PROTOCOL:                                                      */
+    /* direct the producer to send length and content in one go       */
+    iov[0].iov_base = &fh;     iov[0].iov_len = sizeof(fh);
+    for (k = 0; k < cnt; k++) iov[k+1] = vec[k];
+    pre = -ECANCELED;
+    if ((pc->flag & (XFL_F_FTCHHDR | XFL_F_FTCHDAT)) == 0)
+      {
+#ifdef XFL_URING
+        /* with io_uring the reply is read in the same system call    */
+        rc = -2;
+        if ((pc->flag & XFL_F_SEQPKT) == 0 && xfl_uringsetup() == 0)
+          { struct iovec wv;
+            wv.iov_base = "FTCH"; wv.iov_len = 4;
+            rc = xfl_uringrw(pc->fdr,&wv,1,pc->fdf,iov,
+                                        buflen > 0 ? cnt + 1 : 1,&pre); }
+        if (rc < -1)
+#endif
+        rc = write(pc->fdr,"FTCH",4);
+        if (rc < 0)
+          { if (errno == EPIPE || errno == ECONNRESET) {
+ xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+            rc = 0 - errno; if (rc == 0) rc = -1;
+            perror("fetch(): write():");  /* standard Unix report */
+            return rc; }
+        pc->flag |= XFL_F_FTCHHDR; }
+
+    got = 0;
+    if (pc->flag & XFL_F_FTCHHDR)
+      {
+        /* PROTOCOL:                                                  */
+        /* gather the frame header and as much content as will fit    */
+        if (pre == -ECANCELED) xfl_pipewait(pc->fdf);
+        if (pre != -ECANCELED) rc = pre;        /* io_uring read it */
+        else if ((pc->flag & XFL_F_SEQPKT) && buflen == 0)
+            rc = recv(pc->fdf,&fh,sizeof(fh),MSG_PEEK);  /* leave it */
+        else if (pc->flag & XFL_F_SEQPKT)
+          { memset(&mh,0x00,sizeof(mh));
+            mh.msg_iov = iov; mh.msg_iovlen = cnt + 1;
+            rc = recvmsg(pc->fdf,&mh,MSG_TRUNC); }  /* real length */
+        else rc = readv(pc->fdf,iov,buflen > 0 ? cnt + 1 : 1);
+        if (rc < 0 && errno == ECONNRESET) rc = 0;  /* socket peer gone */
+        if (rc < 0)
+          { rc = 0 - errno; if (rc == 0) rc = -1;
+            perror("fetch(): readv()");    /* provide standard report */
+            return rc; }
+        if (rc == 0)                       /* producer has gone away */
+          { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+        /* finish the header if the pipe gave us only part of it      */
+        if (rc < sizeof(fh) && (pc->flag & XFL_F_SEQPKT)) return -1;
+        if (rc < sizeof(fh))
+          { got = xfl_readfull(pc->fdf,(char*) &fh + rc,sizeof(fh) - rc);
+            if (got < sizeof(fh) - rc) return -1;
+            rc = sizeof(fh); }
+        got = rc - sizeof(fh);
+
+        /* the producer may instead say that there are no more        */
+        if (fh.flag & XFL_FRAME_EOF)
+          { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+        /* the frame must be for the record we are expecting          */
+        reclen = fh.len;
+        if (fh.seq != pc->rn + 1 || reclen < 0)
+          { char *msgv[3], em[2][16];
+            /* 3105 E Record &1 expected from the producer; record &2 found */
+            sprintf(em[0],"%d",pc->rn + 1); msgv[1] = em[0];
+            sprintf(em[1],"%d",fh.seq); msgv[2] = em[1];
+            xfl_error(3105,3,msgv,"LIB");
+            xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -1; }
+
+        /* having only peeked at the message we leave it where it is  */
+        if ((pc->flag & XFL_F_SEQPKT) && buflen == 0)
+          { pc->plen = reclen; return reclen; }
+
+        pc->flag &= ~XFL_F_FTCHHDR;
+        pc->flag |= XFL_F_FTCHDAT;
+        pc->plen = reclen; pc->poff = 0;
+      }
+    else reclen = pc->plen;          /* length was read by a prior call */
+
+    /* a length query leaves the content waiting in the pipe          */
+    if (buflen == 0 && got == 0) return reclen;
+
+    /* a record too big for the buffer must still be drained          */
+    if (buflen < reclen)
+      { xfl_fetchskip(pc,reclen - got);
+        return -1; }
+
+    /* and pick up the rest of the content if it came in pieces       */
+    if (got < reclen)
+      { rc = xfl_readfullv(pc->fdf,vec,cnt,got,reclen - got);
+        if (rc < reclen - got) return -1; }
+
+    pc->flag &= ~XFL_F_FTCHDAT;
+    return reclen;
+  }
+
+/* ---------------------------------------------------------------------
+ *  xfl_fetchv() for the usual case of one contiguous buffer
+ */
+static int xfl_fetch(PIPECONN*pc,void*buffer,int buflen)
+  { struct iovec iov;
+
+    if (buffer == NULL || buflen <= 0) return xfl_fetchv(pc,NULL,0);
+    iov.iov_base = buffer; iov.iov_len = buflen;
+    return xfl_fetchv(pc,&iov,1);
+  }
+
 /* -------------------------------------------------------------- PEEKTO
  *  CONSUMER SIDE
  *  Returns: number of bytes in the record or negative for error
@@ -623,7 +3353,22 @@ int xfl_peekto(PIPECONN*pc,void*buffer,int buflen)
 //return -614;
 
     /* if the connection was severed then return XFL_E_SEVERED (12)   */
-    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -1; }
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+    /* looking at the whole record ends any reading of it in pieces   */
+    pc->flag &= ~XFL_F_PART;
+
+#ifdef XFL_SHMEM
+    /* with a shared ring the record is simply there to be looked at  */
+    if (pc->flag & XFL_F_SHMEM)
+      { struct XFLFRAME *f; unsigned int at;
+        reclen = xfl_shmpeek(pc,&f,&at);
+        if (reclen < 0) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        if (buflen == 0) return reclen;
+        if (buflen < reclen) return -1;
+        memcpy(buffer,&f[1],reclen);
+        return reclen; }
+#endif
 
 /*
 
@@ -643,13 +3388,21 @@ int xfl_peekto(PIPECONN*pc,void*buffer,int buflen)
 
  */
 
+    /* once the producer has advertised FTCH use the single round trip */
+    if (pc->flag & (XFL_F_FTCHHDR | XFL_F_FTCHDAT))
+        return xfl_fetch(pc,buffer,buflen);
+    if (pc->plvl >= 3) return xfl_fetch(pc,buffer,buflen);
+
     /* PROTOCOL:                                                      */
     /* direct the producer to report the size of this record */
-    rc = write(pc->fdr,"STAT",4);
+    /* (unless xfl_wait_any() already asked and the reply is coming)  */
+    if (pc->flag & XFL_F_STATHDR) rc = 0;
+                             else rc = write(pc->fdr,"STAT",4);
+    pc->flag &= ~XFL_F_STATHDR;
     if (rc < 0)
       { char *msgv[2], em[16];
-        if (errno == EPIPE) {
- xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -1; }
+        if (errno == EPIPE || errno == ECONNRESET) {
+ xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
         rc = 0 - errno; if (rc == 0) rc = -1;
         perror("peekto(): write():"); /* provide standard Unix report */
 //      /* also throw a pipelines/ductwork/plenum error and bail out  */
@@ -661,6 +3414,7 @@ int xfl_peekto(PIPECONN*pc,void*buffer,int buflen)
     /* PROTOCOL:                                                      */
     /* read the response which should simply have an integer string   */
     rc = read(pc->fdf,infobuff,sizeof(infobuff));
+    if (rc < 0 && errno == ECONNRESET) rc = 0;      /* socket peer gone */
     if (rc < 0)
       { char *msgv[2], em[16];
         rc = 0 - errno; if (rc == 0) rc = -1;
@@ -672,6 +3426,11 @@ int xfl_peekto(PIPECONN*pc,void*buffer,int buflen)
     infobuff[rc] = 0x00;
 //printf("xfl_peekto: infobuff = '%s'\n",infobuff);
 
+    /* the producer has gone away, or has said that there are no more */
+    if (rc == 0 || (rc == sizeof(struct XFLFRAME)
+               && (((struct XFLFRAME*) infobuff)->flag & XFL_FRAME_EOF)))
+      { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
     /* convert integer string into a binary integer */
 //  if (*infobuff is non-digit) then set this connector to close
 if (*infobuff == 0x00) return -1;    // FIXME: also set an errno
@@ -679,6 +3438,12 @@ if (*infobuff == 0x00) return -1;    // FIXME: also set an errno
     if (isdigit(*infobuff))
     reclen = atoi(infobuff);
 //  else { /* shutdown */ }
+
+    /* a newer producer follows the size with its protocol level      */
+      { char *p;
+        p = infobuff; while (isdigit(*p)) p++;
+        if (*p == ' ') pc->plvl = atoi(++p);
+        if (pc->plvl > XFL_PROTOCOL) pc->plvl = XFL_PROTOCOL; }
 //printf("xfl_peekto: expecting %d bytes\n",reclen);
 
     /* undocumented feature: zero-length peekto tells the record size */
@@ -692,7 +3457,7 @@ if (*infobuff == 0x00) return -1;    // FIXME: also set an errno
     rc = write(pc->fdr,"PEEK",4);
     if (rc < 0)
       { char *msgv[2], em[16];
-        if (errno == EPIPE) {
+        if (errno == EPIPE || errno == ECONNRESET) {
 //printf("xfl_peekto(): got an EPIPE for a PEEK\n");
  xfl_sever(pc); return -XFL_E_SEVERED; }
         rc = 0 - errno; if (rc == 0) rc = -1;
@@ -704,7 +3469,7 @@ if (*infobuff == 0x00) return -1;    // FIXME: also set an errno
 //printf("xfl_peekto: sent PEEK; expecting %d bytes\n",reclen);
 
     /* PROTOCOL:                                                      */
-    rc = read(pc->fdf,buffer,reclen);
+    rc = xfl_readfull(pc->fdf,buffer,reclen);
     if (rc < 0)
       { char *msgv[2], em[16];
         rc = 0 - errno; if (rc == 0) rc = -1;
@@ -717,6 +3482,214 @@ if (*infobuff == 0x00) return -1;    // FIXME: also set an errno
     return rc;
   }
 
+/* -------------------------------------------------------- PEEKTO_ALLOC
+ *  CONSUMER SIDE
+ *  Like xfl_peekto() but grows the caller's buffer to fit the record.
+ *  *buffer may start out NULL with *bufsize zero. The caller frees it.
+ *  There is always at least one byte to spare for a string terminator.
+ *  Returns: number of bytes in the record or negative for error
+ */
+int xfl_peekto_alloc(PIPECONN*pc,void**buffer,int*bufsize)
+  { static char _eyecatcher[] = "xfl_peekto_alloc()";
+    int  reclen, size;
+    void *p;
+
+    if (pc == NULL || buffer == NULL || bufsize == NULL)
+      { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* find out how big the record is without taking it               */
+    reclen = xfl_peekto(pc,NULL,0);
+    if (reclen < 0) return reclen;
+
+    /* grow the buffer by doubling so that it settles quickly         */
+    if (*buffer == NULL || *bufsize < reclen + 1)
+      { size = 4096;
+        while (size < reclen + 1 && size < 0x40000000) size = size * 2;
+        if (size < reclen + 1) size = reclen + 1;
+        p = realloc(*buffer,size);
+        if (p == NULL)
+          { char *msgv[2], em[16]; int en;
+            en = errno;    /* hold onto the error value in case it resets */
+            perror("xfl_peekto_alloc(): realloc()");   /* standard report */
+            sprintf(em,"%d",en); msgv[1] = em;   /* integer to string */
+            xfl_error(26,2,msgv,"LIB");    /* provide specific report */
+            return -1; }
+        *buffer = p; *bufsize = size; }
+
+    if (reclen == 0) return 0;
+    return xfl_peekto(pc,*buffer,reclen);
+  }
+
+/* --------------------------------------------------------- PEEKTO_PART
+ *  CONSUMER SIDE
+ *  Hands over the current record a piece at a time, in order, so that
+ *  a stage can pass along a record of any size with a modest buffer.
+ *  Returns: number of bytes in this piece, zero when the whole record
+ *           has been handed over, or negative for error
+ *  The record is not consumed; follow with xfl_readto() as usual.
+ */
+int xfl_peekto_part(PIPECONN*pc,void*buffer,int buflen)
+  { static char _eyecatcher[] = "xfl_peekto_part()";
+    int  rc, n;
+
+    if (pc == NULL || buffer == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* be sure we are on the input side of the connection             */
+    if ((pc->flag & XFL_F_INPUT) == 0)
+      { fprintf(stderr,"xfl_peekto_part: called for a non-input connector\n");
+        return -1; }
+
+    /* if the connection was severed then return XFL_E_SEVERED (12)   */
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+#ifdef XFL_SHMEM
+    /* with a shared ring each piece comes straight out of the ring   */
+    if (pc->flag & XFL_F_SHMEM)
+      { struct XFLFRAME *f; unsigned int at;
+        rc = xfl_shmpeek(pc,&f,&at);
+        if (rc < 0) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        if ((pc->flag & XFL_F_PART) == 0)
+          { pc->flag |= XFL_F_PART; pc->plen = rc; pc->poff = 0; }
+        n = pc->plen - pc->poff; if (n > buflen) n = buflen;
+        memcpy(buffer,(char*) &f[1] + pc->poff,n);
+        pc->poff = pc->poff + n;
+        return n; }
+#endif
+
+    /* over pipes at level 3 a length query reads the frame header    */
+    /* and leaves the content in the pipe to be read as it arrives    */
+    if ((pc->flag & (XFL_F_PART | XFL_F_SEQPKT)) == 0)
+      { rc = xfl_peekto(pc,NULL,0);
+        if (rc < 0) return rc;
+        if (pc->flag & XFL_F_FTCHDAT) pc->flag |= XFL_F_PART; }
+    if ((pc->flag & XFL_F_PART) && (pc->flag & XFL_F_FTCHDAT))
+      { n = pc->plen - pc->poff; if (n > buflen) n = buflen;
+        rc = xfl_readfull(pc->fdf,buffer,n);
+        if (rc < n) return -1;
+        pc->poff = pc->poff + n;
+        if (pc->poff == pc->plen) pc->flag &= ~XFL_F_FTCHDAT;
+        return n; }
+
+    /* otherwise stage the whole record and hand it over from there   */
+    if ((pc->flag & XFL_F_PART) == 0)
+      { rc = xfl_peekto_alloc(pc,&pc->buff,&pc->bsiz);
+        if (rc < 0) return rc;
+        pc->flag |= XFL_F_PART; pc->plen = rc; pc->poff = 0; }
+    n = pc->plen - pc->poff; if (n > buflen) n = buflen;
+    if (n <= 0) return 0;
+    memcpy(buffer,(char*) pc->buff + pc->poff,n);
+    pc->poff = pc->poff + n;
+    return n;
+  }
+
+/* -------------------------------------------------------------- PEEKREF
+ *  CONSUMER SIDE
+ *  Like xfl_peekto() but lends the record instead of copying it out.
+ *  With a shared ring *ptr points straight into the ring; otherwise
+ *  the record is read into a buffer which the connector keeps.
+ *  Either way the record is good until the next xfl_readto() or peek
+ *  on this connector, and must not be changed.
+ *  Returns: number of bytes in the record or negative for error
+ */
+int xfl_peekref(PIPECONN*pc,const void**ptr,int*len)
+  { static char _eyecatcher[] = "xfl_peekref()";
+    int  rc;
+
+    if (pc == NULL || ptr == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* be sure we are on the input side of the connection             */
+    if ((pc->flag & XFL_F_INPUT) == 0)
+      { fprintf(stderr,"xfl_peekref: called for a non-input connector\n");
+        return -1; }
+
+    /* if the connection was severed then return XFL_E_SEVERED (12)   */
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+    pc->flag &= ~XFL_F_PART;
+
+#ifdef XFL_SHMEM
+    /* with a shared ring the record is lent where it lies            */
+    if (pc->flag & XFL_F_SHMEM)
+      { struct XFLFRAME *f; unsigned int at;
+        rc = xfl_shmpeek(pc,&f,&at);
+        if (rc < 0) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        *ptr = &f[1];
+        if (len != NULL) *len = rc;
+        return rc; }
+#endif
+
+    /* otherwise it lands in the staging buffer of the connector      */
+    rc = xfl_peekto_alloc(pc,&pc->buff,&pc->bsiz);
+    if (rc < 0) return rc;
+    *ptr = pc->buff;
+    if (len != NULL) *len = rc;
+    return rc;
+  }
+
+/* ------------------------------------------------------------- PEEKTOV
+ *  CONSUMER SIDE
+ *  Like xfl_peekto() but scatters the record into up to XFL_IOV_MAX
+ *  pieces, for instance a fixed size header and a separate payload.
+ *  Returns: number of bytes in the record or negative for error
+ *  The pieces together must have room for the whole record.
+ */
+int xfl_peektov(PIPECONN*pc,const struct iovec*vec,int cnt)
+  { static char _eyecatcher[] = "xfl_peektov()";
+    int  rc, reclen, buflen, k;
+    char *p;
+
+    if (pc == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
+    if (cnt < 0 || cnt > XFL_IOV_MAX || (cnt > 0 && vec == NULL))
+      { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* be sure we are on the input side of the connection             */
+    if ((pc->flag & XFL_F_INPUT) == 0)
+      { fprintf(stderr,"xfl_peektov: called for a non-input connector\n");
+        return -1; }
+
+    /* if the connection was severed then return XFL_E_SEVERED (12)   */
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+    pc->flag &= ~XFL_F_PART;
+
+    buflen = 0;
+    for (k = 0; k < cnt; k++) buflen = buflen + vec[k].iov_len;
+
+#ifdef XFL_SHMEM
+    /* with a shared ring the pieces are copied straight out of it    */
+    if (pc->flag & XFL_F_SHMEM)
+      { struct XFLFRAME *f; unsigned int at; int n;
+        reclen = xfl_shmpeek(pc,&f,&at);
+        if (reclen < 0) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        if (buflen == 0) return reclen;
+        if (buflen < reclen) return -1;
+        p = (char*) &f[1];
+        for (k = 0, rc = reclen; k < cnt && rc > 0; k++)
+          { n = vec[k].iov_len; if (n > rc) n = rc;
+            memcpy(vec[k].iov_base,p,n); p = p + n; rc = rc - n; }
+        return reclen; }
+#endif
+
+    /* at level 3 the fetch reply lands directly in the pieces        */
+    if (pc->flag & (XFL_F_FTCHHDR | XFL_F_FTCHDAT))
+        return xfl_fetchv(pc,vec,cnt);
+    if (pc->plvl >= 3) return xfl_fetchv(pc,vec,cnt);
+
+    /* an older producer has to be asked first, which tells its level */
+    reclen = xfl_peekto(pc,NULL,0);
+    if (reclen < 0 || buflen == 0) return reclen;
+    if (pc->plvl >= 3) return xfl_fetchv(pc,vec,cnt);
+    if (buflen < reclen) return -1;
+
+    /* otherwise take the record whole and hand it out in pieces      */
+    p = malloc(reclen + 1);
+    if (p == NULL) { perror("xfl_peektov(): malloc()"); return -1; }
+    rc = xfl_peekto(pc,p,reclen);
+    for (k = 0, buflen = 0; k < cnt && rc > buflen; k++)
+      { reclen = vec[k].iov_len; if (reclen > rc - buflen) reclen = rc - buflen;
+        memcpy(vec[k].iov_base,p + buflen,reclen); buflen = buflen + reclen; }
+    free(p);
+    return rc;
+  }
+
 /* -------------------------------------------------------------- READTO
  *  CONSUMER SIDE
  *  Returns: number of bytes in the record or negative for error
@@ -726,7 +3699,6 @@ if (*infobuff == 0x00) return -1;    // FIXME: also set an errno
 int xfl_readto(PIPECONN*pc,void*buffer,int buflen)
   { static char _eyecatcher[] = "xfl_readto()";
     int  rc;
-    char  infobuff[256];
 
     if (pc == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
 
@@ -736,7 +3708,8 @@ int xfl_readto(PIPECONN*pc,void*buffer,int buflen)
         return -1; } // FIXME: get a better return code
 
     /* if the connection was severed then return XFL_E_SEVERED (12)   */
-    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -1; }
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+    pc->flag &= ~XFL_F_PART;
 
     /* if buffer supplied and length not zero then try to get data    */
     if (buffer != NULL && buflen > 0)
@@ -744,20 +3717,43 @@ int xfl_readto(PIPECONN*pc,void*buffer,int buflen)
         if (rc < 0) return rc; }
     /* this also checks things like which side this connector is for  */
 
+#ifdef XFL_SHMEM
+    /* with a shared ring we just move the tail past this record      */
+    if (pc->flag & XFL_F_SHMEM)
+      { rc = xfl_shmnext(pc);
+        if (rc < 0) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        pc->rn = pc->rn + 1;
+        return 0; }
+#endif
+
+    /* so must a size report which xfl_wait_any() asked for           */
+    if (pc->flag & XFL_F_STATHDR)
+      { rc = xfl_peekto(pc,NULL,0);
+        if (rc < 0) return rc; }
+
+    /* a fetch reply nobody looked at must be cleared from the pipe   */
+    if (pc->flag & (XFL_F_FTCHHDR | XFL_F_FTCHDAT))
+      { if ((pc->flag & XFL_F_FTCHDAT) == 0)
+          { rc = xfl_fetch(pc,NULL,0);
+            if (rc < 0) return rc; }
+        xfl_fetchskip(pc,pc->plen - pc->poff); }
+
     /* PROTOCOL:                                                      */
-    /* direct the producer to proceed with the next record */
-    rc = write(pc->fdr,"NEXT",4);
+    /* direct the producer to proceed with the next record            */
+    /* and, at level 2, to send the one after it as soon as it can    */
+    if (pc->plvl >= 3) rc = write(pc->fdr,"NXFT",4);
+                  else rc = write(pc->fdr,"NEXT",4);
     if (rc < 0)
       { char *msgv[2], em[16];
-        if (errno == EPIPE) {
- xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -1; }
+        if (errno == EPIPE || errno == ECONNRESET) {
+ xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
         rc = 0 - errno; if (rc == 0) rc = -1;
         perror("readto(): write():");      /* standard Unix report */
         /* also throw a pipelines/ductwork/plenum error and bail out  */
         sprintf(em,"%d",rc); msgv[1] = em;       /* integer to string */
         xfl_error(26,2,msgv,"LIB");        /* provide specific report */
         return rc; }
-
+    if (pc->plvl >= 3) pc->flag |= XFL_F_FTCHHDR;  /* reply is coming */
 
     /* increment the record counter */
     pc->rn = pc->rn + 1;
@@ -765,31 +3761,427 @@ int xfl_readto(PIPECONN*pc,void*buffer,int buflen)
     return 0;
   }
 
-/* -------------------------------------------------------------- OUTPUT
- *  PRODUCER SIDE
- *  Returns: number of bytes written to output or negative for error
- *  A return value of zero is not an error if the record was null.
- *  This routine sits in a loop driven by the consumer.
- *  See also: xfl_peekto() and xfl_readto()
+/* -------------------------------------------------------- READTO_BATCH
+ *  CONSUMER SIDE
+ *  Read and consume up to "n" records in one exchange, packed one after
+ *  another into "buffer". Each "iov" element is set to point at one.
+ *  This waits for the first record, but not for any which follow it.
+ *  Returns: number of records consumed, zero if the next record does
+ *  not fit (it stays put, to be read some other way), -XFL_E_SEVERED
+ *  at end of stream, or other negative for error
  */
-int xfl_output(PIPECONN*pc,void*buffer,int buflen)
-  { static char _eyecatcher[] = "xfl_output()";
-    int rc, xx;
-    char  infobuff[256];
-int n;
+int xfl_readto_batch(PIPECONN*pc,struct iovec*iov,int n,
+                                                    void*buffer,int buflen)
+  { static char _eyecatcher[] = "xfl_readto_batch()";
+    int  rc, k, used, lens[XFL_BATCH_MAX];
+    char  ctrl[12];
+    struct XFLFRAME fh;
+    struct iovec hv[2];
+
+    if (pc == NULL || iov == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
+    if (n < 1) return 0;
+    if (n > XFL_BATCH_MAX) n = XFL_BATCH_MAX;
+    if (buffer == NULL) buflen = 0;
+
+    /* be sure we are on the input side of the connection             */
+    if ((pc->flag & XFL_F_INPUT) == 0)
+      { fprintf(stderr,"xfl_readto_batch: called for a non-input connector\n");
+        return -1; }
+
+    /* if the connection was severed then return XFL_E_SEVERED (12)   */
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+    pc->flag &= ~XFL_F_PART;
+
+#ifdef XFL_SHMEM
+    /* with a shared ring take whatever is already posted             */
+    if (pc->flag & XFL_F_SHMEM)
+      { k = xfl_shmbatch(pc,iov,n,buffer,buflen);
+        if (k < 0)
+          { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        pc->rn = pc->rn + k;
+        xfl_errno = XFL_E_NONE;
+        return k; }
+#endif
+
+    /* until the producer is known to take "BTCH", or while a fetch   */
+    /* reply is already on its way, go one record at a time           */
+    if (pc->plvl < 4 || (pc->flag & (XFL_F_FTCHHDR | XFL_F_FTCHDAT)))
+      { rc = xfl_peekto(pc,NULL,0);
+        if (rc < 0) return rc;
+        if (rc > buflen) { xfl_errno = XFL_E_NONE; return 0; }
+        rc = xfl_peekto(pc,buffer,buflen);
+        if (rc < 0) return rc;
+        iov[0].iov_base = buffer; iov[0].iov_len = rc;
+        if (pc->plvl < 4) rc = xfl_readto(pc,NULL,0); else
+          { /* plain "NEXT" so that no reply is owed for next time     */
+            rc = write(pc->fdr,"NEXT",4);
+            if (rc < 0) { xfl_sever(pc); xfl_errno = XFL_E_SEVERED;
+                          rc = -XFL_E_SEVERED; }
+                   else pc->rn = pc->rn + 1; }
+        return (rc < 0) ? rc : 1; }
+
+    /* PROTOCOL:                                                      */
+    /* ask for as many records as we have room for, in one message    */
+    memcpy(ctrl,"BTCH",4);
+    memcpy(ctrl + 4,&n,sizeof(int));
+    memcpy(ctrl + 8,&buflen,sizeof(int));
+    rc = write(pc->fdr,ctrl,sizeof(ctrl));
+    if (rc < 0)
+      { if (errno == EPIPE || errno == ECONNRESET) {
+ xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        rc = 0 - errno; if (rc == 0) rc = -1;
+        perror("readto_batch(): write():");   /* standard Unix report */
+        return rc; }
+
+    /* PROTOCOL:                                                      */
+    /* the frame and lengths come first, as one message on a socket   */
+    if (pc->flag & XFL_F_SEQPKT)
+      { hv[0].iov_base = &fh;  hv[0].iov_len = sizeof(fh);
+        hv[1].iov_base = lens; hv[1].iov_len = n * sizeof(int);
+        rc = readv(pc->fdf,hv,2);
+        if (rc < (int) sizeof(fh)) rc = -1;
+        k = fh.resv; }
+    else
+      { rc = xfl_readfull(pc->fdf,&fh,sizeof(fh));
+        if (rc < (int) sizeof(fh)) rc = -1;
+        k = fh.resv;
+        if (rc > 0 && k > 0 && k <= n)
+          { rc = xfl_readfull(pc->fdf,lens,k * sizeof(int));
+            if (rc < k * sizeof(int)) rc = -1; } }
+    if (rc < 0) { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+    /* the producer may instead say that there are no more            */
+    if (fh.flag & XFL_FRAME_EOF)
+      { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+    /* the frame must be a batch starting with the record we expect   */
+    if ((fh.flag & XFL_FRAME_BATCH) == 0 || fh.seq != pc->rn + 1
+     || k < 0 || k > n || fh.len < 0 || (k > 0 && fh.len > buflen))
+      { char *msgv[3], em[2][16];
+        /* 3105 E Record &1 expected from the producer; record &2 found */
+        sprintf(em[0],"%d",pc->rn + 1); msgv[1] = em[0];
+        sprintf(em[1],"%d",fh.seq); msgv[2] = em[1];
+        xfl_error(3105,3,msgv,"LIB");
+        xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -1; }
+
+    /* nothing fit, so the current record stays where it is           */
+    if (k == 0) { xfl_errno = XFL_E_NONE; return 0; }
+
+    /* PROTOCOL:                                                      */
+    /* and then all of the records, back to back                      */
+    rc = xfl_readfull(pc->fdf,buffer,fh.len);
+    if (rc < fh.len) { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+    for (used = 0, rc = 0; rc < k; rc++)
+      { iov[rc].iov_base = (char*) buffer + used; iov[rc].iov_len = lens[rc];
+        used = used + lens[rc]; }
+
+    /* increment the record counter */
+    pc->rn = pc->rn + k;
+
+    return k;
+  }
+
+/* ------------------------------------------------------------- PENDING
+ *  CONSUMER SIDE
+ *  Returns 1 if a record (or end of stream) is ready to be looked at,
+ *  or 0 after making sure the producer has been asked to send one, so
+ *  that the data side of the connector becomes readable when it does.
+ */
+static int xfl_pending(PIPECONN*pc)
+  { int rc;
+
+    if (pc->flag & XFL_F_SEVERED) return 1;
+    if (pc->flag & (XFL_F_FTCHDAT | XFL_F_PART)) return 1;
+
+#ifdef XFL_SHMEM
+    /* a ring has a record when more have been posted than consumed   */
+    if (pc->flag & XFL_F_SHMEM)
+      { struct XFLSHMHDR *hdr;
+        hdr = ((struct XFLSHM*)pc->buff)->hdr;
+        if (__atomic_load_n(&hdr->pseq,__ATOMIC_ACQUIRE) != hdr->cseq) return 1;
+        if (__atomic_load_n(&hdr->flag,__ATOMIC_ACQUIRE) != 0) return 1;
+        if (xfl_shmpeer(pc) < 0) return 1;
+        return 0; }
+#endif
+
+    /* a reply already on its way need only be waited for             */
+    if (pc->flag & (XFL_F_FTCHHDR | XFL_F_STATHDR)) return 0;
+
+    /* PROTOCOL:                                                      */
+    /* otherwise ask now; the producer answers when it has a record   */
+    if (pc->plvl >= 3)
+      { rc = write(pc->fdr,"FTCH",4);
+        if (rc == 4) pc->flag |= XFL_F_FTCHHDR; }
+    else
+      { rc = write(pc->fdr,"STAT",4);
+        if (rc == 4) pc->flag |= XFL_F_STATHDR; }
+    if (rc < 0 && (errno == EPIPE || errno == ECONNRESET)) xfl_sever(pc);
+    if (rc < 0) return 1;  /* let the next peek report the trouble    */
+
+    return 0;
+  }
+
+#if defined(XFL_SHMEM) && defined(SYS_futex_waitv) && defined(FUTEX_32)
+/* ------------------------------------------------------------ SHMWAITV
+ *  CONSUMER SIDE
+ *  Sleep until any of the rings is posted to, for at most "ms" (or the
+ *  usual nap, after which the caller looks for vanished producers).
+ */
+static void xfl_shmwaitv(PIPECONN**pcs,int n,int ms)
+  { struct futex_waitv fw[XFL_WAIT_MAX];
+    struct XFLSHMHDR *hdr;
+    struct timespec ts;
+    long ns;
+    int k;
+
+    for (k = 0; k < n; k++)
+      { hdr = ((struct XFLSHM*)pcs[k]->buff)->hdr;
+        fw[k].val = hdr->cseq;
+        fw[k].uaddr = (unsigned long) &hdr->pseq;
+        fw[k].flags = FUTEX_32; fw[k].__reserved = 0;
+        __atomic_store_n(&hdr->cwait,1,__ATOMIC_SEQ_CST); }
+
+    /* the producer only wakes us if we said we sleep, so look again  */
+    for (k = 0; k < n; k++)
+      { hdr = ((struct XFLSHM*)pcs[k]->buff)->hdr;
+        if (__atomic_load_n(&hdr->pseq,__ATOMIC_SEQ_CST) != fw[k].val) break; }
+
+    if (k == n)
+      { ns = XFL_SHM_NAPTIME;
+        if (ms >= 0 && (long) ms * 1000000 < ns) ns = (long) ms * 1000000;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        ts.tv_nsec = ts.tv_nsec + ns;
+        if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+        syscall(SYS_futex_waitv,fw,n,0,&ts,CLOCK_MONOTONIC); }
+
+    for (k = 0; k < n; k++)
+      { hdr = ((struct XFLSHM*)pcs[k]->buff)->hdr;
+        __atomic_store_n(&hdr->cwait,0,__ATOMIC_RELAXED); }
+  }
+#endif
+
+/* ------------------------------------------------------------ WAITANY
+ *  the work of xfl_wait_any() with room for "n" of everything supplied
+ */
+static int xfl_waitany(PIPECONN**pcs,int n,int timeout,
+                struct pollfd*pf,PIPECONN**rings,PIPECONN**pipes)
+  { int  rc, k, ready, npf, nshm, ms;
+    struct timespec t0, t1;
+
+    for (k = 0; k < n; k++)
+      { if (pcs[k] == NULL) continue;
+        if ((pcs[k]->flag & XFL_F_INPUT) == 0)
+          { fprintf(stderr,"xfl_wait_any: called for a non-input connector\n");
+            return -1; } }
+
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    while (1)
+      {
+        /* see who is ready, asking the others to send when they can  */
+        ready = npf = nshm = 0;
+        for (k = 0; k < n; k++)
+          { if (pcs[k] == NULL) continue;
+            pcs[k]->flag &= ~XFL_F_READY;
+            if (xfl_pending(pcs[k]))
+              { pcs[k]->flag |= XFL_F_READY; ready++; continue; }
+            if (pcs[k]->flag & XFL_F_SHMEM) rings[nshm++] = pcs[k];
+            else { pf[npf].fd = pcs[k]->fdf; pf[npf].events = POLLIN;
+                   pf[npf].revents = 0; pipes[npf++] = pcs[k]; } }
+
+        if (ready > 0 || timeout == 0) return ready;
+
+        /* how much longer may we wait?                               */
+        ms = -1;
+        if (timeout > 0)
+          { clock_gettime(CLOCK_MONOTONIC,&t1);
+            ms = timeout - ((t1.tv_sec - t0.tv_sec) * 1000
+                          + (t1.tv_nsec - t0.tv_nsec) / 1000000);
+            if (ms <= 0) return 0; }
+
+#if defined(XFL_SHMEM) && defined(SYS_futex_waitv) && defined(FUTEX_32)
+        /* rings alone can all be slept on at once                    */
+        if (nshm > 0 && npf == 0 && nshm <= XFL_WAIT_MAX)
+          { xfl_shmwaitv(rings,nshm,ms); continue; }
+#endif
+        /* but a ring cannot be polled, so with pipes in the mix we   */
+        /* take short naps and look at the rings in between           */
+        if (nshm > 0 && (ms < 0 || ms > 1)) ms = 1;
+
+        /* the pipes become readable when the producer answers        */
+        rc = poll(pf,npf,ms);
+        if (rc < 0 && errno != EINTR)
+          { rc = 0 - errno;
+            perror("xfl_wait_any(): poll()");  /* standard Unix report */
+            return rc; }
+
+        /* a reply (or a hang-up) has arrived for these              */
+        for (k = 0; rc > 0 && k < npf; k++)
+          if (pf[k].revents != 0)
+            { pipes[k]->flag |= XFL_F_READY; ready++; }
+        if (ready > 0) return ready;
+      }
+  }
+
+/* ------------------------------------------------------------ WAIT_ANY
+ *  CONSUMER SIDE
+ *  Wait until at least one of "n" input connectors has a record ready
+ *  to be looked at (or has come to the end of its stream), or until
+ *  "timeout" milliseconds pass. Negative waits indefinitely, zero not
+ *  at all. Each connector which is ready gets XFL_F_READY in its flag,
+ *  the others lose it. NULL entries in the list are skipped.
+ *  Up to XFL_WAIT_MAX are handled on the stack, more are allocated.
+ *  Returns: number of connectors ready, zero at timeout, or negative
+ */
+int xfl_wait_any(PIPECONN**pcs,int n,int timeout)
+  { static char _eyecatcher[] = "xfl_wait_any()";
+    struct pollfd pf0[XFL_WAIT_MAX], *pf;
+    PIPECONN *pv0[XFL_WAIT_MAX * 2], **pv;
+    int  rc;
+
+    if (pcs == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
+    if (n < 0) { xfl_errno = XFL_E_2756; return -1; }
+
+    if (n <= XFL_WAIT_MAX)
+      return xfl_waitany(pcs,n,timeout,pf0,pv0,&pv0[XFL_WAIT_MAX]);
+
+    pf = malloc(n * sizeof(struct pollfd));
+    pv = malloc(n * 2 * sizeof(PIPECONN*));
+    if (pf == NULL || pv == NULL)
+      { rc = 0 - errno; free(pf); free(pv);
+        perror("xfl_wait_any(): malloc()");    /* standard Unix report */
+        return rc; }
+
+    rc = xfl_waitany(pcs,n,timeout,pf,pv,&pv[n]);
+    free(pf); free(pv);
+    return rc;
+  }
+
+/* -------------------------------------------------------- PEEKTO_NOWAIT
+ *  CONSUMER SIDE
+ *  Like xfl_peekto() but returns -EAGAIN rather than wait for a record.
+ */
+int xfl_peekto_nowait(PIPECONN*pc,void*buffer,int buflen)
+  { static char _eyecatcher[] = "xfl_peekto_nowait()";
+    int  rc;
 
     if (pc == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
 
-    /* be sure we are on the output side of the connection            */
-    if ((pc->flag & XFL_F_OUTPUT) == 0)
-//    { xfl_error(100,0,NULL,"LIB");       /* provide specific report */
-      { fprintf(stderr,"xfl_output: called for a non-output connector\n");
-        return -1; } // FIXME: get a better return code
+    rc = xfl_wait_any(&pc,1,0);
+    if (rc < 0) return rc;
+    if (rc == 0) return -EAGAIN;
 
-    /* if the connection was severed then return XFL_E_SEVERED (12)   */
-    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -1; }
+    return xfl_peekto(pc,buffer,buflen);
+  }
 
-//printf("xfl_output: '%s' %d %d\n",buffer,buflen,strlen(buffer));
+/* ----------------------------------------------------------- SENDBATCH
+ *  PRODUCER SIDE, reply to "BTCH"
+ *  Send a frame with the BATCH flag and the number of records in resv,
+ *  then that many lengths, then the records back to back. A record is
+ *  taken only whole and only within "count" records and "bytes" bytes.
+ *  If not even the first fits, the count is zero and len says how big
+ *  it is. Over a socket the frame and lengths go as one message.
+ *  Returns: number of records sent or negative
+ */
+static int xfl_sendbatch(PIPECONN*pc,const struct iovec*vec,int cnt,
+                const struct iovec*more,int nmore,int count,int bytes)
+  { struct iovec iov[XFL_IOV_MAX + XFL_BATCH_MAX + 2];
+    struct XFLFRAME fh;
+    int lens[XFL_BATCH_MAX];
+    int rc, k, n, total;
+
+    if (count > XFL_BATCH_MAX) count = XFL_BATCH_MAX;
+
+    /* see how many records fit, always starting with the current one */
+    total = 0;
+    for (k = 0; k < cnt; k++) total = total + vec[k].iov_len;
+    k = 0;
+    if (count > 0 && total <= bytes)
+      { lens[k++] = total;
+        while (k < count && k - 1 < nmore
+            && more[k-1].iov_len <= bytes - total)
+          { lens[k] = more[k-1].iov_len;
+            total = total + lens[k++]; } }
+
+    fh.len = total; fh.seq = pc->rn + 1;
+    fh.flag = XFL_FRAME_BATCH; fh.resv = k;
+    iov[0].iov_base = &fh; iov[0].iov_len = sizeof(fh);
+    iov[1].iov_base = lens; iov[1].iov_len = k * sizeof(int);
+    n = 2;
+    if (k > 0)
+      { memcpy(&iov[n],vec,cnt * sizeof(struct iovec)); n = n + cnt;
+        memcpy(&iov[n],more,(k - 1) * sizeof(struct iovec)); n = n + k - 1; }
+
+    if (pc->flag & XFL_F_SEQPKT)
+      { rc = xfl_writeall(pc->fdf,iov,2);
+        if (rc >= 0) rc = xfl_sendrec(pc,NULL,&iov[2],n - 2); }
+    else rc = xfl_sendrec(pc,NULL,iov,n);
+    if (rc < 0) return rc;
+
+    return k;
+  }
+
+/* ------------------------------------------------------------ SENDNEXT
+ *  PRODUCER SIDE, pipes and sockets
+ *  Send the record as xfl_sendrec() does and, with the io_uring backend,
+ *  read the consumer's next control message in the same system call.
+ *  Sets *clen to the length of what landed in "ctrl", or to -1 when
+ *  nothing was read and the caller should read the control pipe itself.
+ */
+static int xfl_sendnext(PIPECONN*pc,struct XFLFRAME*fh,
+                  const struct iovec*vec,int cnt,char*ctrl,int*clen)
+  { int rc, k, total;
+
+    *clen = -1;
+#ifdef XFL_URING
+    /* only a small record over a stream; a socket which keeps messages */
+    /* whole wants its reads sized for them                           */
+    total = 0;
+    for (k = 0; k < cnt; k++) total = total + vec[k].iov_len;
+    if ((pc->flag & XFL_F_SEQPKT) == 0 && cnt < XFL_IOV_MAX
+     && total <= XFL_URING_SMALL && xfl_uringsetup() == 0)
+      { struct iovec iov[XFL_IOV_MAX+1], cv;
+        int n, got;
+        n = 0;
+        if (fh != NULL)
+          { iov[0].iov_base = fh; iov[0].iov_len = sizeof(*fh); n = 1; }
+        for (k = 0; k < cnt; k++) if (vec[k].iov_len > 0) iov[n++] = vec[k];
+        if (n == 0) return 0;
+        cv.iov_base = ctrl; cv.iov_len = 4;
+        rc = xfl_uringrw(pc->fdf,iov,n,pc->fdr,&cv,1,&got);
+        if (rc >= -1)
+          { struct iovec rest[XFL_IOV_MAX+1]; int m;
+            if (rc < 0) return rc;
+            /* finish a write which the pipe took only part of        */
+            for (k = 0, m = 0; k < n; k++)
+              { if (rc >= iov[k].iov_len) { rc = rc - iov[k].iov_len; continue; }
+                rest[m].iov_base = (char*) iov[k].iov_base + rc;
+                rest[m].iov_len = iov[k].iov_len - rc; rc = 0; m++; }
+            if (m > 0 && xfl_writeall(pc->fdf,rest,m) < 0) return -1;
+            if (got > 0) *clen = got;
+            return total; } }
+#endif
+
+    return xfl_sendrec(pc,fh,vec,cnt);
+  }
+
+/* ------------------------------------------------------------- OUTLOOP
+ *  PRODUCER SIDE, pipes and sockets
+ *  This routine sits in a loop driven by the consumer. The record is
+ *  gathered from the pieces in "vec". Any records which follow it, as
+ *  from xfl_output_batch(), are in "more", and a "BTCH" may take some.
+ *  Returns: number of records consumed (at least one) or negative
+ */
+static int xfl_outloop(PIPECONN*pc,const struct iovec*vec,int cnt,
+                                        const struct iovec*more,int nmore)
+  { static char _eyecatcher[] = "xfl_outloop()";
+    int rc, xx, buflen, k, took, clen;
+    char  infobuff[256];
+int n;
+
+    buflen = 0;
+    for (k = 0; k < cnt; k++) buflen = buflen + vec[k].iov_len;
+    took = 1; clen = -1;
 
 n = 0;
     while (1)
@@ -798,8 +4190,15 @@ n = n + 1;
         /* the following is a blocking read; this routine waits until *
          * the consumer side signals that it is ready to consume      */
 //      rc = read(pc->fdr,infobuff,sizeof(infobuff));
-        rc = 0; while (rc == 0)
-        rc = read(pc->fdr,infobuff,4);    /* expect 4 bytes by design */
+        /* after "NXFT" the consumer is owed this record unasked      */
+        if (pc->flag & XFL_F_FTCHHDR)
+          { pc->flag &= ~XFL_F_FTCHHDR;
+            strcpy(infobuff,"FTCH"); rc = 4; } else
+        /* the control message may have come back with the last reply */
+        if (clen > 0) { rc = clen; clen = -1; } else {
+        xfl_pipewait(pc->fdr);
+        rc = 0; while (rc == 0)           /* a socket keeps messages whole */
+        rc = read(pc->fdr,infobuff,(pc->flag & XFL_F_SEQPKT) ? 12 : 4); }
         if (rc < 4)
           { char *msgv[2], em[16];
 //          rc = errno; if (rc == 0) rc = -1;
@@ -808,7 +4207,12 @@ n = n + 1;
             sprintf(em,"%d",rc); msgv[1] = em;   /* integer to string */
             xfl_error(26,2,msgv,"LIB");    /* provide specific report */
 printf("xfl_output: error trying to read the control channel after %d %d\n",n,rc);
-            return rc; }
+            return rc < 0 ? rc : -1; }
+        /* "BTCH" carries two integers, which a pipe may hold back    */
+        if ((*infobuff == 'B' || *infobuff == 'b') && rc == 4)
+          { rc = xfl_readfull(pc->fdr,infobuff + 4,8);
+            rc = (rc == 8) ? 12 : -1; }
+        if (rc < 0) return rc;
         infobuff[rc] = 0x00;
 //printf("xfl_output: infobuff = '%s'\n",infobuff);
 
@@ -817,17 +4221,39 @@ printf("xfl_output: error trying to read the control channel after %d %d\n",n,rc
           {
             case 'S': case 's':                               /* STAT */
                 /* PROTOCOL: send the size of the record              */
-                sprintf(infobuff,"%d",buflen);   /* say # bytes avail */
+                /* followed by our protocol level (old consumers stop */
+                /* at the blank, newer ones may then use "FTCH")      */
+                sprintf(infobuff,"%d %d",buflen,XFL_PROTOCOL);
                 rc = write(pc->fdf,infobuff,strlen(infobuff)+1);
                 break;
 
+            case 'F': case 'f':                               /* FTCH */
+                /* PROTOCOL: send frame header and then the record    */
+                  { struct XFLFRAME fh;
+                    fh.len = buflen; fh.seq = pc->rn + 1;
+                    fh.flag = fh.resv = 0;
+                    rc = xfl_sendnext(pc,&fh,vec,cnt,infobuff,&clen); }
+                break;
+
             case 'P': case 'p':                               /* PEEK */
                 /* PROTOCOL: send the record downstream               */
-                rc = write(pc->fdf,buffer,buflen);   /* send the data */
+                rc = xfl_sendnext(pc,NULL,vec,cnt,infobuff,&clen);
+                break;
+
+            case 'B': case 'b':                               /* BTCH */
+                /* PROTOCOL: send as many records as the consumer can */
+                /* take and count them all consumed (level 4 and up)  */
+                  { int want[2];
+                    memcpy(want,infobuff + 4,sizeof(want));
+                    rc = xfl_sendbatch(pc,vec,cnt,more,nmore,want[0],want[1]);
+                    if (rc > 0) { took = rc; xx = 1; } }
                 break;
 
-            case 'N': case 'n':                               /* NEXT */
+            case 'N': case 'n':                        /* NEXT or NXFT */
                 /* PROTOCOL: acknowledge to consumer we unblocked     */
+                /* and for "NXFT" send the next record when it comes  */
+                if (toupper(infobuff[1]) == 'X')
+                    pc->flag |= XFL_F_FTCHHDR;
                 rc = 0;
                 xx = 1;
                 break;
@@ -850,27 +4276,131 @@ printf("xfl_output: protocol error '%s'\n",infobuff);
 
         if (rc < 0)
           { char *msgv[2], em[16];
-            if (errno == EPIPE) {
- xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -1; }
+            if (errno == EPIPE || errno == ECONNRESET) {
+ xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
             rc = errno; if (rc == 0) rc = -1;
             perror("xfl_output(): write():");   /* Unix system report */
             /* also throw a pipelines/ductwork/plenum error and bail  */
             sprintf(em,"%d",rc); msgv[1] = em;   /* integer to string */
             xfl_error(26,2,msgv,"LIB");    /* provide specific report */
 printf("xfl_output: error after protocol\n");
-            return rc; }
+            return rc > 0 ? 0 - rc : rc; }
 
         if (xx) break;
       }
 
     /* increment the record counter */
-    pc->rn = pc->rn + 1;
+    pc->rn = pc->rn + took;
+
+    return took;
+  }
+
+/* -------------------------------------------------------------- OUTPUT
+ *  PRODUCER SIDE
+ *  Returns: number of bytes written to output or negative for error
+ *  A return value of zero is not an error if the record was null.
+ *  See also: xfl_outputv(), which does the work
+ */
+int xfl_output(PIPECONN*pc,void*buffer,int buflen)
+  { static char _eyecatcher[] = "xfl_output()";
+    struct iovec iov;
+
+    iov.iov_base = buffer; iov.iov_len = buflen;
+    return xfl_outputv(pc,&iov,buflen > 0 ? 1 : 0);
+  }
+
+/* ------------------------------------------------------------- OUTPUTV
+ *  PRODUCER SIDE
+ *  Writes one record gathered from up to XFL_IOV_MAX pieces, so that
+ *  a header and a payload need not first be copied together.
+ *  Returns: zero or negative for error
+ *  See also: xfl_peekto() and xfl_readto()
+ */
+int xfl_outputv(PIPECONN*pc,const struct iovec*vec,int cnt)
+  { static char _eyecatcher[] = "xfl_outputv()";
+    int rc, buflen, k;
+
+    if (pc == NULL) { xfl_errno = XFL_E_NULLPTR; return -1; }
+    if (cnt < 0 || cnt > XFL_IOV_MAX || (cnt > 0 && vec == NULL))
+      { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* the record is as long as all of its pieces put together        */
+    buflen = 0;
+    for (k = 0; k < cnt; k++) buflen = buflen + vec[k].iov_len;
+
+    /* be sure we are on the output side of the connection            */
+    if ((pc->flag & XFL_F_OUTPUT) == 0)
+//    { xfl_error(100,0,NULL,"LIB");       /* provide specific report */
+      { fprintf(stderr,"xfl_output: called for a non-output connector\n");
+        return -1; } // FIXME: get a better return code
+
+    /* if the connection was severed then return XFL_E_SEVERED (12)   */
+    if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+
+//printf("xfl_output: '%s' %d %d\n",buffer,buflen,strlen(buffer));
+
+#ifdef XFL_SHMEM
+    /* with a shared ring the record goes straight into memory        */
+    if (pc->flag & XFL_F_SHMEM)
+      { rc = xfl_shmoutput(pc,vec,cnt,buflen);
+        if (rc < 0)
+          { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        pc->rn = pc->rn + 1;
+        return 0; }
+#endif
+
+    rc = xfl_outloop(pc,vec,cnt,NULL,0);
+    if (rc < 0) return rc;
 
 //printf("xfl_output: (normal exit)\n");
 
     return 0;
   }
 
+/* -------------------------------------------------------- OUTPUT_BATCH
+ *  PRODUCER SIDE
+ *  Writes "n" records, each one described by an element of "recs".
+ *  A consumer which uses xfl_readto_batch() takes many per exchange.
+ *  Returns: zero or negative for error
+ */
+int xfl_output_batch(PIPECONN*pc,const struct iovec*recs,int n)
+  { static char _eyecatcher[] = "xfl_output_batch()";
+    int rc, i;
+
+    rc = 0;
+    if (pc == NULL || (n > 0 && recs == NULL))
+      { xfl_errno = XFL_E_NULLPTR; return -1; }
+
+    /* be sure we are on the output side of the connection            */
+    if ((pc->flag & XFL_F_OUTPUT) == 0)
+      { fprintf(stderr,"xfl_output_batch: called for a non-output connector\n");
+        return -1; }
+
+#ifdef XFL_SHMEM
+    /* with a shared ring place them all, then publish them at once   */
+    if (pc->flag & XFL_F_SHMEM)
+      { unsigned int seq;
+        if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        seq = ((struct XFLSHM*)pc->buff)->hdr->pseq;
+        for (i = 0; i < n; i++)
+          { rc = xfl_shmplace(pc,&recs[i],1,recs[i].iov_len,&seq);
+            if (rc < 0) break;
+            pc->rn = pc->rn + 1; }
+        if (rc >= 0) rc = xfl_shmpost(pc,seq);
+        if (rc < 0)
+          { xfl_sever(pc); xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        return 0; }
+#endif
+
+    /* otherwise the consumer takes them one or many at a time        */
+    for (i = 0; i < n; i = i + rc)
+      { if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_SEVERED; return -XFL_E_SEVERED; }
+        rc = xfl_outloop(pc,&recs[i],1,&recs[i+1],n - i - 1);
+        if (rc < 0) return rc; }
+
+    return 0;
+  }
+
 /* --------------------------------------------------------------- SEVER
  *  Sever a connection: tell the upstream, close FDs, mark it severed
  */
@@ -882,10 +4412,24 @@ int xfl_sever(PIPECONN*pc)
     /* if already severed then return no error */
     if (pc->flag & XFL_F_SEVERED) { xfl_errno = XFL_E_NONE; return 0; }
 
+#ifdef XFL_SHMEM
+    /* a shared ring carries the sever in its header instead of QUIT  */
+    if (pc->flag & XFL_F_SHMEM) xfl_shmsever(pc); else
+#endif
     /* if this is an input then signal upstream to shut it down */
     if (pc->flag & XFL_F_INPUT) write(pc->fdr,"QUIT",4);
+    /* if an output then tell the consumer plainly that no more follow, */
+    /* which it will see even while some other process holds the pipe */
+    else if (pc->flag & XFL_F_OUTPUT)
+      { struct XFLFRAME fh;
+        fh.len = -1; fh.seq = pc->rn + 1;
+        fh.flag = XFL_FRAME_EOF; fh.resv = 0;
+        write(pc->fdf,&fh,sizeof(fh)); }
     /* close the file descriptors */
-    close(pc->fdf); close(pc->fdr);
+    close(pc->fdf); if (pc->fdr != pc->fdf) close(pc->fdr);
+    if (pc->fdm >= 0) { close(pc->fdm); pc->fdm = -1; }
+    /* a connector without a ring may hold a staging buffer           */
+    if (pc->buff != NULL) { free(pc->buff); pc->buff = NULL; }
     /* mark this connection as severed */
     pc->flag |= XFL_F_SEVERED;
 
@@ -899,7 +4443,7 @@ int xfl_sever(PIPECONN*pc)
  *    but they facilitate any language using call-by-reference.       *
  * ------------------------------------------------------------------ */
 
-static struct PIPECONN *xfl_pc_common = NULL;
+static XFL_TLS struct PIPECONN *xfl_pc_common = NULL;
 
 int XFLVERSN(char*b)
   { /* return the version (numbers only) to the caller                */
@@ -910,7 +4454,7 @@ int XFLVERSN(char*b)
     return 0; }
 
 /* ------------------------------------------------------------------ *
- *    NOTE: these are ham-strung and only do stream zero              *
+ *    NOTE: stream numbers are zero-based; zero is the primary stream *
  * ------------------------------------------------------------------ */
 
 int XFLINIT()
@@ -932,14 +4476,12 @@ int XFLINIT()
 int XFLPEEK(int*sn,char*b,int*bl)
   {
     int rc;
-    struct PIPECONN *pi, *pn;
+    struct PIPECONN *pi;
 
     XFLINIT();
 
-    /* snag the first input stream from the chain-o-connectors        */
-    pi = NULL;
-    for (pn = xfl_pc_common; pi == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_INPUT) pi = pn;
+    /* go straight to the stream asked for                            */
+    pi = xfl_input_stream(*sn);
 
     rc = xfl_peekto(pi,b,*bl);                        /* sip on input */
     if (rc < 0) return rc;
@@ -951,14 +4493,12 @@ int XFLPEEK(int*sn,char*b,int*bl)
 int XFLOUT(int*sn,char*b,int*bl)
   {
     int rc;
-    struct PIPECONN *po, *pn;
+    struct PIPECONN *po;
 
     XFLINIT();
 
-    /* snag the first output stream from the chain-o-connectors       */
-    po = NULL;
-    for (pn = xfl_pc_common; po == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_OUTPUT) po = pn;
+    /* go straight to the stream asked for                            */
+    po = xfl_output_stream(*sn);
 
     rc = xfl_output(po,b,*bl);                    /* write the record */
     if (rc < 0) return rc;
@@ -969,14 +4509,12 @@ int XFLOUT(int*sn,char*b,int*bl)
 int XFLREAD(int*sn,char*b,int*bl)
   {
     int rc;
-    struct PIPECONN *pi, *pn;
+    struct PIPECONN *pi;
 
     XFLINIT();
 
-    /* snag the first input stream from the chain-o-connectors        */
-    pi = NULL;
-    for (pn = xfl_pc_common; pi == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_INPUT) pi = pn;
+    /* go straight to the stream asked for                            */
+    pi = xfl_input_stream(*sn);
 
     rc = xfl_readto(pi,b,*bl);            /* consume the input record */
     if (rc < 0) return rc;
@@ -27,6 +27,8 @@
 #include <rexxsaa.h>
 
 static struct PIPECONN *xfl_rxpc = NULL;
+static char *xfl_rxbuf = NULL;  /* records handed to Rexx, any size */
+static int xfl_rxbsz = 0;
 
 extern int xfl_errno;
 
@@ -104,7 +106,7 @@ int rxpeekto(ULONG rxargc, RXSTRING rxargv[],RXSTRING*rxrets)
   {
     int rc, l, j, buflen;
     char buffer[4096];
-    struct PIPECONN *pc, *pi, *pn;
+    struct PIPECONN *pc, *pi;
 
     pc = xfl_rxpc;
 
@@ -114,25 +116,20 @@ int rxpeekto(ULONG rxargc, RXSTRING rxargv[],RXSTRING*rxrets)
     j = atoi(buffer);            /* the number of the selected stream */
     rxargv++;  rxargc--;   /* bump count and pointer to next argument */
 
-    /* snag the first input stream from the chain-o-connectors        */
-    pi = NULL;
-    for (pn = pc; pi == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_INPUT) pi = pn;
+    /* go straight to the selected stream                             */
+    pi = xfl_input_stream(j);
 
-    buflen = sizeof(buffer) - 1;
-    rc = xfl_peekto(pi,buffer,buflen);                /* sip on input */
-//printf("rxpeekto(): xfl_peekto(,,%d) returned %d\n",buflen,rc);
+    /* the record lands in a buffer that grows to fit, so any size goes */
+    rc = xfl_peekto_alloc(pi,(void**) &xfl_rxbuf,&xfl_rxbsz);   /* sip */
+//printf("rxpeekto(): xfl_peekto_alloc() returned %d\n",rc);
 
     if (rc < 0)
       { /* FIXME: return something other than an empty error string   */
         rxrets->strptr[0] = 0x00; rxrets->strlength = 0;
         return rc; }
 
-    buflen = rc;
-    if (buflen > rxrets->strlength) buflen = rxrets->strlength;
-    sprintf(rxrets->strptr,"%s",buffer);
-//  snprintf(rxrets->strptr,buflen,"%s",buffer);
-    rxrets->strlength = strlen(rxrets->strptr);
+    xfl_rxbuf[rc] = 0x00;                     /* terminate the string */
+    rxrets->strptr = xfl_rxbuf; rxrets->strlength = rc;
 
 //  rxrets->strptr[0] = 0x00; rxrets->strlength = 0;
     return 0;
@@ -148,7 +145,7 @@ int rxreadto(ULONG rxargc, RXSTRING rxargv[],RXSTRING*rxrets)
   {
     int rc, l, j, buflen;
     char buffer[4096];
-    struct PIPECONN *pc, *pi, *pn;
+    struct PIPECONN *pc, *pi;
 
 //printf("rxreadto(): %d args\n",rxargc);
     pc = xfl_rxpc;
@@ -162,24 +159,22 @@ int rxreadto(ULONG rxargc, RXSTRING rxargv[],RXSTRING*rxrets)
 
 //printf("rxreadto(): %d\n",j);
 
-    /* snag the first input stream from the chain-o-connectors        */
-    pi = NULL;
-    for (pn = pc; pi == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_INPUT) pi = pn;
+    /* go straight to the selected stream                             */
+    pi = xfl_input_stream(j);
 
-    buflen = sizeof(buffer) - 1;
-    rc = xfl_readto(pi,buffer,buflen);          /* consume the record */
-//printf("rxreadto(): xfl_readto(,,%d) returned %d\n",buflen,rc);
+    /* take a look at the record, growing the buffer to fit it        */
+    rc = xfl_peekto_alloc(pi,(void**) &xfl_rxbuf,&xfl_rxbsz);
+    if (rc >= 0) { buflen = rc; rc = xfl_readto(pi,NULL,0); }
+//printf("rxreadto(): xfl_readto() returned %d\n",rc);
 
     if (rc < 0)
       { /* FIXME: return something other than an empty error string   */
         rxrets->strptr[0] = 0x00; rxrets->strlength = 0;
         return rc; }
 
-    buflen = rc;
-    if (buflen > rxrets->strlength) buflen = rxrets->strlength;
-    snprintf(rxrets->strptr,buflen,"%s",buffer);
-    rxrets->strlength = strlen(rxrets->strptr);
+    xfl_rxbuf[buflen] = 0x00;                 /* terminate the string */
+    rxrets->strptr = xfl_rxbuf; rxrets->strlength = buflen;
+    rc = buflen;
 
 //  rxrets->strptr[0] = 0x00; rxrets->strlength = 0;
     return rc;
@@ -195,7 +190,7 @@ int rxoutput(ULONG rxargc, RXSTRING rxargv[],RXSTRING*rxrets)
   {
     int rc, l, j, buflen;
     char buffer[4096];
-    struct PIPECONN *pc, *po, *pn;
+    struct PIPECONN *pc, *po;
 
 //printf("rxoutput(): %d args\n",rxargc);
     pc = xfl_rxpc;
@@ -209,10 +204,8 @@ int rxoutput(ULONG rxargc, RXSTRING rxargv[],RXSTRING*rxrets)
 
 //printf("rxoutput(): %d\n",j);
 
-    /* snag the first output stream from the chain-o-connectors       */
-    po = NULL;
-    for (pn = pc; po == NULL && pn != NULL; pn = pn->next)
-      if (pn->flag & XFL_F_OUTPUT) po = pn;
+    /* go straight to the selected stream                             */
+    po = xfl_output_stream(j);
 
 //printf("rxoutput(): '%s'\n",rxargv->strptr);
     rc = xfl_output(po,rxargv->strptr,rxargv->strlength);
@@ -338,6 +331,13 @@ RxDuctwork(CONST CHAR *name,
 //  if (rc < 0) if (xfl_errno == XFL_E_SEVERED) rc = XFL_E_SEVERED;
     if (rc < 0) rc = 0 - rc;      /* force negative RC to be positive */
            else rc = 0;            /* but positive RC is not an error */
+
+    /* a record bigger than the interpreter's return buffer needs more */
+    rl = strlen(rxrets.strptr) + 16;
+    if (rl > retstr->strlength)
+      { rs = RexxAllocateMemory(rl);
+        if (rs == NULL) return RXFUNC_NOMEM;
+        retstr->strptr = rs; }
     sprintf(retstr->strptr,"%d %s",rc,rxrets.strptr);
 //  snprintf(retstr->strptr,retstr->strlength,"%d %s",rc,rxrets.strptr);
     retstr->strlength = strlen(retstr->strptr);
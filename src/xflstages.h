@@ -0,0 +1,35 @@
+/*
+ *        Name: xflstages.h (C program header)
+ *              the stages which come with Ductwork
+ *        Date: 2026-10-17 (Sat)
+ *
+ * One line per stage: the verb and the shortest abbreviation allowed.
+ * Define XFL_STAGE(verb,min) before including this. The library makes
+ * its table of verbs from it, the multicall stage program its table
+ * of entry points, and stages/makefile the list of what goes into the
+ * multicall program, which it reads from here with sed(1), so keep
+ * each entry on a line of its own and starting in the first column.
+ * Aliases such as ELASTIC and the magical file syntax are in xfllib.c.
+ */
+
+XFL_STAGE(buffer,6)
+XFL_STAGE(cms,3)
+XFL_STAGE(command,7)
+XFL_STAGE(console,4)
+XFL_STAGE(count,5)
+XFL_STAGE(cp,2)
+XFL_STAGE(fanin,5)
+XFL_STAGE(faninany,8)
+XFL_STAGE(filea,5)
+XFL_STAGE(filer,5)
+XFL_STAGE(filew,5)
+XFL_STAGE(hole,4)
+XFL_STAGE(literal,7)
+XFL_STAGE(locate,6)
+XFL_STAGE(nlocate,7)
+XFL_STAGE(parallel,8)
+XFL_STAGE(reverse,7)
+XFL_STAGE(strliteral,10)
+XFL_STAGE(var,3)
+
+#undef XFL_STAGE